@@ -1,3 +1,6 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
 #ifdef CONFIG_64BIT
 #define BITS_PER_LONG 64
 #else
@@ -35,3 +38,60 @@
 #define NBITS(n) (n==0?0:NBITS32(n))
 
 #define EXTRACT_NBITS(nr, h, l) ((nr&GENMASK(h,l)) >> l)
+
+/*
+ * Bitmap helpers. Words are addressed through BIT_WORD()/BIT_MASK() so a
+ * bitmap of @nr bits needs DIV_ROUND_UP(nr, BITS_PER_LONG) longs.
+ */
+static inline void set_bit(int nr, unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(int nr, unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+/* Atomic variants for bitmaps written by several threads without a lock */
+static inline void atomic_set_bit(int nr, unsigned long *addr)
+{
+	__atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr), __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_clear_bit(int nr, unsigned long *addr)
+{
+	__atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr), __ATOMIC_SEQ_CST);
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[BIT_WORD(nr)] & BIT_MASK(nr)) != 0;
+}
+
+/*
+ * find_next_bit - find the first set bit at or after @offset
+ * Return @size when no bit is set in [@offset, @size)
+ */
+static inline unsigned long find_next_bit(const unsigned long *addr,
+		unsigned long size, unsigned long offset)
+{
+	unsigned long word, bits;
+
+	if (offset >= size)
+		return size;
+
+	word = offset / BITS_PER_LONG;
+	bits = addr[word] & (~0UL << (offset % BITS_PER_LONG));
+	while (!bits) {
+		if (++word * BITS_PER_LONG >= size)
+			return size;
+		bits = addr[word];
+	}
+	offset = word * BITS_PER_LONG + __builtin_ctzl(bits);
+	return (offset < size) ? offset : size;
+}
+
+#define find_first_bit(addr, size) find_next_bit((addr), (size), 0)
+
+#endif /* BITOPS_H */
@@ -9,6 +9,8 @@
 #include "os-cfg.h"
 #endif
 
+#include "rbtree.h"
+
 #ifndef OSMM_H
 #include "os-mm.h"
 #endif
@@ -23,25 +25,58 @@
 #define NUM_PAGES	(1 << (ADDRESS_SIZE - OFFSET_LEN))
 #define PAGE_SIZE	(1 << OFFSET_LEN)
 
+#define NR_REGS		10
+#define MAX_LOOP_DEPTH	8	// Loops nested in a program file
+
 enum ins_opcode_t {
 	CALC,	// Just perform calculation, only use CPU
 	ALLOC,	// Allocate memory
 	FREE,	// Deallocated a memory block
 	READ,	// Write data to a byte on memory
-	WRITE	// Read data from a byte on memory
+	WRITE,	// Read data from a byte on memory
+	MEMSET,	// Fill a range of a region with a byte
+	MEMCPY,	// Copy a range of a region to another
+	READN,	// Read a range of a region
+	WRITEN,	// Write a range of a region, counting up from a byte
+	/* Control flow, they move the pc themselves and take no time slot */
+	JUMP,	// Go to an instruction
+	JZ,	// Go to an instruction if a register is zero
+	JNZ,	// Go to an instruction if a register is not zero
+	LOOP,	// Run the instructions up to the matching ENDLOOP N times
+	ENDLOOP,
+	/* Fused by the loader, not in program files */
+	ALLOC_WRITE,	// ALLOC then WRITE to the same region
+	WRITE_READ,	// WRITE then READ from the same region
+	NR_OPCODES
 };
 
+struct pcb_t;
+struct inst_t;
+
+/* Handler of an instruction, see run() */
+typedef int (*exec_t)(struct pcb_t * proc, const struct inst_t * ins);
+
 /* instructions executed by the CPU */
 struct inst_t {
 	enum ins_opcode_t opcode;
 	uint32_t arg_0; // Argument lists for instructions
 	uint32_t arg_1;
 	uint32_t arg_2;
+	uint32_t arg_3;	// Bulk and fused instructions only
+	uint32_t arg_4;
+	uint32_t steps;	// Instructions of the program file it stands for
 };
 
 struct code_seg_t {
 	struct inst_t * text;
 	uint32_t size;
+	/* Shared by the processes of a program file, see load() */
+	uint32_t priority;	// Default priority in the program file
+	uint32_t refs;
+	char * path;
+	struct code_seg_t * next;	// In the cache bucket of path
+	void * map;	// Mapped binary program file, text points into it
+	uint32_t map_len;
 };
 
 struct trans_table_t {
@@ -63,17 +98,38 @@ struct page_table_t {
 	int size;	// Number of row in the first layer
 };
 
+/* Counters of a process, only updated by the CPU running it */
+struct perf_stat_t {
+	uint32_t retired[NR_OPCODES];	// Instructions of the program file run
+	uint32_t tlb_hits;
+	uint32_t tlb_misses;
+	uint32_t minor_faults;	// Pages mapped to a free or reclaimed frame
+	uint32_t major_faults;	// Accesses to a page out on swap
+	uint32_t swap_ins;
+	uint32_t swap_outs;	// Pages it pushed out to swap, its own or not
+	uint32_t peak_frames;	// Most frames of MEMRAM its pages held at once
+	uint32_t ctx_switches;	// Times it was put back before finishing
+};
+
 /* PCB, describe information about a process */
 struct pcb_t {
 	uint32_t pid;	// PID
 	uint32_t priority; // Default priority, this legacy (FIXED) value depend on process itself
 	struct code_seg_t * code;	// Code segment
-	addr_t regs[10]; // Registers, store address of allocated regions
+	addr_t regs[NR_REGS]; // Registers, store address of allocated regions
 	uint32_t pc; // Program pointer, point to the next instruction
+	uint32_t rep;	// Steps of the instruction at pc already run
+	/* Loops the pc is in, innermost last */
+	uint32_t loop_pc[MAX_LOOP_DEPTH];	// Index of the LOOP instruction
+	uint32_t loop_left[MAX_LOOP_DEPTH];	// Iterations left, this one included
+	uint32_t nr_loops;
 #ifdef MLQ_SCHED
 	// Priority on execution (if supported), on-fly aka. changeable
 	// and this vale overwrites the default priority when it existed
 	uint32_t prio;     
+	/* Fair policy: weighted CPU time used, and the run queue tree link */
+	uint64_t vruntime;
+	struct rb_node run_node;
 #endif
 #ifdef CPU_TLB
 	struct memphy_struct *tlb;
@@ -86,6 +142,19 @@ struct pcb_t {
 #endif
 	struct page_table_t * page_table; // Page table
 	uint32_t bp;	// Break pointer
+	int last_cpu;	// CPU this process last ran on, -1 before its first dispatch
+	uint32_t migrations;	// Dispatches on a CPU other than last_cpu
+	struct perf_stat_t perf;
+	uint32_t quantum;	// Time slots granted to the next slice
+#ifdef SCHED_STAT
+	/* Scheduling timestamps, in time slots */
+	uint64_t arrival;	// Admitted by add_proc()
+	uint64_t first_dispatch;
+	uint64_t ready_since;	// Last time it entered a run queue
+	uint64_t wait;		// Total time spent in run queues
+	uint32_t nr_dispatch;
+	uint64_t quantum_sum;	// Sum of the quanta of every slice
+#endif
 
 };
 
@@ -4,10 +4,26 @@
 
 #include "common.h"
 
-/* Execute an instruction of a process. Return 0
- * if the instruction is executed successfully.
- * Otherwise, return 1. */
+/* Execute an instruction of a process. Return the time slots it keeps
+ * the CPU for under the cost model, at least 1. */
 int run(struct pcb_t * proc);
 
+/* Run the calc instructions from the pc on, at once, for up to [max]
+ * time slots and return the slots they take; the last one may go past
+ * [max]. Loops and jumps between them are followed. */
+int run_calc(struct pcb_t * proc, int max);
+
+/* Pick the memory backend by name: tlb, paging or legacy, among those
+ * built in. Return 0 on success. */
+int set_mm_backend(const char * name);
+
+/* Read the time slots of each opcode and the penalties of TLB misses,
+ * page faults and swaps from [path], as lines of a name and a number:
+ * calc, alloc, free, read, write, memset, memcpy, readn, writen,
+ * tlb_miss, page_fault, swap_in, swap_out. Missing ones keep their
+ * default, one slot per instruction and no penalty. Return 0 on
+ * success. */
+int load_cost_model(const char * path);
+
 #endif
 
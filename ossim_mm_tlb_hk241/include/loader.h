@@ -3,7 +3,44 @@
 
 #include "common.h"
 
+/*
+ * Binary program file, written by progbin from a text program: the
+ * header, then [size] instructions already linked and fused the way the
+ * simulator built with the same configuration runs them. load() maps it,
+ * checks the instructions once and runs them in place.
+ */
+#define PROG_MAGIC	"OSPB"
+#define PROG_VERSION	2
+
+/* prog_header_t flags, a file only loads in a build with the same ones */
+#define PROG_FUSED	1	// Built with INST_FUSION
+
+#ifdef INST_FUSION
+#define PROG_FLAGS	PROG_FUSED
+#else
+#define PROG_FLAGS	0
+#endif
+
+struct prog_header_t {
+	char magic[4];
+	uint32_t version;	// Bumped when enum ins_opcode_t changes
+	uint32_t inst_size;	// sizeof(struct inst_t)
+	uint32_t flags;
+	uint32_t priority;
+	uint32_t size;
+};
+
+/* Create a process running the program at [path], a text or binary
+ * program file. Processes of the same path share its code segment,
+ * read by the first load(). */
 struct pcb_t * load(const char * path);
 
+/* A process is done with [code], free it once no process uses it */
+void release_code(struct code_seg_t * code);
+
+/* Write the text program at [path] as a binary program file to [out].
+ * Return 0 on success. */
+int save_program(const char * path, const char * out);
+
 #endif
 
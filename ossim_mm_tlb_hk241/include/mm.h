@@ -82,6 +82,8 @@
 #define PAGING_PGN(x)  GETVAL(x,PAGING_PGN_MASK,PAGING_ADDR_PGN_LOBIT)
 /* Extract FramePHY Number*/
 #define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_ADDR_FPN_LOBIT)
+/* Extract FramePHY Number of a present PTE */
+#define PAGING_PTE_FPN(pte)  GETVAL(pte,PAGING_PTE_FPN_MASK,PAGING_PTE_FPN_LOBIT)
 /* Extract SWAPFPN */
 #define PAGING_PGN(x)  GETVAL(x,PAGING_PGN_MASK,PAGING_ADDR_PGN_LOBIT)
 /* Extract SWAPTYPE */
@@ -141,6 +143,13 @@ int pgwrite(
 		BYTE data, // Data to be wrttien into memory
 		uint32_t destination, // Index of destination register
 		uint32_t offset);
+int pgmemset(struct pcb_t *proc, uint32_t rgid, uint32_t offset,
+		uint32_t size, BYTE value);
+int pgmemcpy(struct pcb_t *proc, uint32_t src, uint32_t src_offset,
+		uint32_t dst, uint32_t dst_offset, uint32_t size);
+int pgreadn(struct pcb_t *proc, uint32_t rgid, uint32_t offset, uint32_t size);
+int pgwriten(struct pcb_t *proc, uint32_t rgid, uint32_t offset,
+		uint32_t size, BYTE value);
 /* Local VM prototypes */
 struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
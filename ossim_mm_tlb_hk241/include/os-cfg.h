@@ -3,6 +3,27 @@
 
 #define MLQ_SCHED 1
 #define MAX_PRIO 140
+//#define QUEUE_LOCKFREE
+//#define MLQ_PREEMPT
+/* Least number of queued processes a peer needs over an idle CPU before
+ * it steals: 1 steals whatever waits, 2 leaves a peer its next process */
+#define MIGRATE_THRESHOLD 2
+#define SCHED_STAT 1
+/* Counters of each process as a row of a table when it finishes */
+#define PERF_STAT
+/* Jump over the slots in which every device waits for a later time */
+#define TIMER_FASTFORWARD
+/* Run a stretch of calc at once and skip the barrier for its slots */
+//#define RUN_TO_QUANTUM
+/* Fuse calc runs and same region memory pairs at load time */
+#define INST_FUSION
+/* Wall clock spent working and waiting per timer device, at stop_timer() */
+//#define TIMER_STAT
+//#define ADAPTIVE_QUANTUM
+/* Adaptive quantum: the lowest priority gets QUANTUM_PRIO_SCALE times
+ * time_slot, calc-only processes grow up to QUANTUM_MAX_SCALE times that */
+#define QUANTUM_PRIO_SCALE 2
+#define QUANTUM_MAX_SCALE 4
 
 #define CPU_TLB
 #define CPUTLB_FIXED_TLBSZ
@@ -55,6 +55,9 @@ struct mm_struct {
 
    /* list of free page */
    struct pgn_t *fifo_pgn;
+
+   /* Frames of MEMRAM holding its pages, another process may take one */
+   uint32_t nr_frames;
 };
 
 /*
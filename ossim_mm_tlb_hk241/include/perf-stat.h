@@ -0,0 +1,15 @@
+#ifndef PERF_STAT_H
+#define PERF_STAT_H
+
+#include "common.h"
+
+#ifdef PERF_STAT
+/* Print the counters of the finished [proc] as a row of the perf table,
+ * one line of space separated numbers starting with "perf". The header
+ * row comes before the first one. */
+void report_perf_stat(struct pcb_t * proc);
+#else
+#define report_perf_stat(proc)
+#endif
+
+#endif
@@ -4,12 +4,46 @@
 
 #include "common.h"
 
-#define MAX_QUEUE_SIZE 10
+/* Initial number of slots of a queue, the storage doubles when full */
+#ifndef QUEUE_INIT_SIZE
+#define QUEUE_INIT_SIZE 16
+#endif
+
+#ifdef QUEUE_LOCKFREE
+/*
+ * Bounded multi-producer/multi-consumer ring (D. Vyukov). Every cell
+ * carries a sequence number telling whether it is free for the enqueue
+ * at [seq] or holds the item for the dequeue at [seq - 1], so producers
+ * and consumers only CAS their own position counter. The ring cannot
+ * grow without a lock: [capacity] is a hard limit.
+ */
+struct queue_cell_t {
+	unsigned long seq;
+	struct pcb_t * proc;
+};
 
 struct queue_t {
-	struct pcb_t * proc[MAX_QUEUE_SIZE];
+	struct queue_cell_t * cell;
+	unsigned long capacity;
+	/* Keep both ends on their own cache line */
+	unsigned long enq_pos __attribute__((aligned(64)));
+	unsigned long deq_pos __attribute__((aligned(64)));
+};
+#else
+/* Ring buffer of processes, oldest at [head] */
+struct queue_t {
+	struct pcb_t ** proc;
+	int head;
 	int size;
+	int capacity;
 };
+#endif
+
+/* Prepare an empty queue holding [capacity] processes before growing
+ * (lock-free build: ever). The storage is allocated on first enqueue. */
+void init_queue(struct queue_t * q, int capacity);
+
+void free_queue(struct queue_t * q);
 
 void enqueue(struct queue_t * q, struct pcb_t * proc);
 
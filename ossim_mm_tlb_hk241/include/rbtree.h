@@ -0,0 +1,32 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include <stddef.h>
+
+/* Intrusive red-black tree, the node is embedded in the object it sorts */
+struct rb_node {
+	struct rb_node * parent;
+	struct rb_node * left;
+	struct rb_node * right;
+	int color;
+};
+
+struct rb_root {
+	struct rb_node * node;
+	struct rb_node * leftmost;	// Cached smallest node, NULL if empty
+};
+
+#define RB_ROOT			(struct rb_root) { NULL, NULL }
+#define rb_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define rb_first(root)		((root)->leftmost)
+
+/* Insert [node] ordered by [less], equal keys go after the existing ones */
+void rb_insert(struct rb_root * root, struct rb_node * node,
+	int (*less)(struct rb_node * a, struct rb_node * b));
+
+void rb_erase(struct rb_root * root, struct rb_node * node);
+
+struct rb_node * rb_next(struct rb_node * node);
+
+#endif
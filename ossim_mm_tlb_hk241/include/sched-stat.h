@@ -0,0 +1,29 @@
+#ifndef SCHED_STAT_H
+#define SCHED_STAT_H
+
+#include "common.h"
+
+#ifdef SCHED_STAT
+/* Reserve a record for each of the [num_procs] processes to be run */
+void init_sched_stat(int num_procs);
+
+/* [proc] enters a run queue, [arrival] is set when add_proc() admits it */
+void stat_enqueue(struct pcb_t * proc, int arrival);
+
+/* [proc] was taken from a run queue by a CPU */
+void stat_dispatch(struct pcb_t * proc);
+
+/* [proc] has finished, keep its numbers before the pcb is freed */
+void stat_finish(struct pcb_t * proc);
+
+/* Print the per-process table and the percentiles, then release it all */
+void report_sched_stat(void);
+#else
+#define init_sched_stat(num_procs)
+#define stat_enqueue(proc, arrival)
+#define stat_dispatch(proc)
+#define stat_finish(proc)
+#define report_sched_stat()
+#endif
+
+#endif
@@ -1,28 +1,60 @@
-#ifndef QUEUE_H
-#define QUEUE_H
+#ifndef SCHED_H
+#define SCHED_H
 
 #include "common.h"
 
+struct timer_id_t;
+
 #ifndef MLQ_SCHED
 #define MLQ_SCHED
 #endif
 
-#define MAX_PRIO 139
-
 int queue_empty(void);
 
-void init_scheduler(void);
+/* Nothing is queued on the run queue of [cpu]. get_proc() may still
+ * return NULL when something is, see get_mlq_proc(). */
+int cpu_queue_empty(int cpu);
+
+/* Select the scheduling policy by [name] before init_scheduler():
+ * "mlq" (default), "fair" or "fifo". Return -1 for an unknown name. */
+int set_sched_policy(const char * name);
+
+/* Create one run queue per CPU, must be called before the CPUs start.
+ * [num_procs] is the number of processes the loader will admit and
+ * [time_slot] the quantum of the config file. */
+void init_scheduler(int num_cpus, int num_procs, int time_slot);
 void finish_scheduler(void);
 
-/* Get the next process from ready queue */
-struct pcb_t * get_proc(void);
+/* Get the next process for [cpu] from its own run queue, or steal one
+ * from the busiest peer queueing at least MIGRATE_THRESHOLD processes
+ * more than [cpu] when the local queue gives none */
+struct pcb_t * get_proc(int cpu);
 
-/* Put a process back to run queue */
-void put_proc(struct pcb_t * proc);
+/* Put a process back to the run queue of [cpu] */
+void put_proc(int cpu, struct pcb_t * proc);
 
-/* Add a new process to ready queue */
+/* Add a new process to the least loaded run queue */
 void add_proc(struct pcb_t * proc);
 
+/* [proc] used up its quantum, [faults] page faults were taken during the
+ * slice and [calc_only] tells it ran nothing but calc. With
+ * ADAPTIVE_QUANTUM this sets proc->quantum for the next slice. */
+void end_slice(struct pcb_t * proc, int faults, int calc_only);
+
+#ifdef MLQ_PREEMPT
+/* A process beating the one running on [cpu] was added to its run
+ * queue, return 1 once so the CPU can put its process back */
+int need_resched(int cpu);
+#endif
+
+/* Park [cpu] outside the slot barrier of [timer_id] until a process may
+ * be available to get_proc(cpu) or finish_loading() was called. Whoever
+ * wakes it brings it back into the barrier at the next slot boundary. */
+void wait_proc(int cpu, struct timer_id_t * timer_id);
+
+/* The loader has added every process, release the parked CPUs */
+void finish_loading(void);
+
 #endif
 
 
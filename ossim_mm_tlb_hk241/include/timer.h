@@ -1,28 +1,71 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include "os-cfg.h"
 #include <pthread.h>
 #include <stdint.h>
 
+struct timer_node_t;
+
+/* A device taking part in the slot barrier */
 struct timer_id_t {
-	int done;
+	struct timer_node_t * leaf;	// Barrier node this device arrives at
+	int sense;	// Sense of the slot boundary it waits for
+	int member;	// Counted by the barrier from the current slot on
+	int pending;	// Membership change applied at the next slot boundary
 	int fsh;
-	pthread_cond_t event_cond;
-	pthread_mutex_t event_lock;
-	pthread_cond_t timer_cond;
-	pthread_mutex_t timer_lock;
+	int asleep;	// In wait_until(), out of the barrier until wake_at
+	uint64_t wake_at;
+#ifdef TIMER_STAT
+	int id;	// Attach order, CPUs come first
+	uint64_t mark_ns;	// Wall clock of the last state change
+	uint64_t work_ns;	// Running its share of a slot
+	uint64_t wait_ns;	// In next_slot() for the other devices
+	uint64_t idle_ns;	// Parked or in wait_until()
+	uint64_t done_ns;	// From start_timer() to detach_event()
+	uint32_t nr_last;	// Slots it was the last to arrive in
+#endif
+	struct timer_id_t * next;
 };
 
 void start_timer();
 
+/* With TIMER_STAT, print where the devices spent the wall clock time */
 void stop_timer();
 
+/* Before start_timer() the device takes part from slot 0. Once the timer
+ * runs it is attached parked, its thread calls unpark_event() to take
+ * part from the next slot boundary on. */
 struct timer_id_t * attach_event();
 
 void detach_event(struct timer_id_t * event);
 
+/* Idle devices leave the slot barrier so the other devices stop waiting
+ * for them; unpark_event() rejoins and returns at the next slot boundary */
+void park_event(struct timer_id_t * event);
+
+void unpark_event(struct timer_id_t * event);
+
+/* Called by another device for a parked [event]: it is counted by the
+ * barrier from the next slot on, before its own unpark_event() */
+void wake_event(struct timer_id_t * event);
+
 void next_slot(struct timer_id_t* timer_id);
 
+/* Same as calling next_slot() until current_time() reaches [time], but
+ * the device is out of the barrier meanwhile. With TIMER_FASTFORWARD the
+ * time jumps over slots in which no device is left to run. */
+void wait_until(struct timer_id_t * timer_id, uint64_t time);
+
+/* Call [fire]([arg]) when the time reaches [time], right away if it
+ * already has. It runs at the slot boundary, before any device goes on
+ * with slot [time]; events due in the same slot fire in the order they
+ * were added. Devices woken from [fire] take part in slot [time]. */
+void add_timed_event(uint64_t time, void (*fire)(void * arg), void * arg);
+
+/* Slot of the earliest timed event, UINT64_MAX if there is none */
+uint64_t next_event_time();
+
 uint64_t current_time();
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Reads the words of a mapped text file line by line, for the program
+ * and configure files. Words point into the mapping, nothing is copied
+ * or allocated. Malformed input ends the simulation with the path and
+ * line of the error.
+ */
+struct tokenizer_t {
+	const char * path;
+	const char * buf;	// Mapped file, not NUL terminated
+	const char * pos;
+	const char * end;
+	uint32_t line;	// Line of pos, from 1
+};
+
+/* Map the file at [path] and go to its first non blank line. Return -1
+ * if it cannot be opened. */
+int tok_open(struct tokenizer_t * tok, const char * path);
+
+void tok_close(struct tokenizer_t * tok);
+
+/* Next word of the current line, its length or 0 at the end of line */
+size_t tok_word(struct tokenizer_t * tok, const char ** word);
+
+/* Next word of the current line as a number up to [max], [what] names
+ * it in the error if it is missing or not one */
+unsigned long tok_number(struct tokenizer_t * tok, const char * what,
+		unsigned long max);
+
+/* Check nothing is left on the current line and go to the next non
+ * blank one */
+void tok_end_line(struct tokenizer_t * tok);
+
+/* No line is left */
+int tok_eof(struct tokenizer_t * tok);
+
+/* Print "path:line: " and the message, then exit */
+void tok_error(struct tokenizer_t * tok, const char * fmt, ...)
+	__attribute__((format(printf, 2, 3), noreturn));
+
+/* Print "path:line: warning: " and the message, then go on */
+void tok_warning(struct tokenizer_t * tok, const char * fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#endif
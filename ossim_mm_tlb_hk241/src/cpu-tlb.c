@@ -81,6 +81,11 @@ int tlbread(struct pcb_t * proc, uint32_t source,
   /* by using tlb_cache_read()/tlb_cache_write()*/
   /* frmnum is return value of tlb_cache_read/write value*/
 	
+  if (frmnum < 0)
+    proc->perf.tlb_misses++;
+  else
+    proc->perf.tlb_hits++;
+
 #ifdef IODUMP
   // Print whether TLB hit or miss for debugging
   if (frmnum >= 0)
@@ -97,7 +102,8 @@ int tlbread(struct pcb_t * proc, uint32_t source,
   // Read data from memory
   int val = __read(proc, 0, source, offset, &data);
 
-  destination = (uint32_t) data;
+  if (val == 0 && destination < NR_REGS)
+    proc->regs[destination] = data;
 
   /* TODO update TLB CACHED with frame num of recent accessing page(s)*/
   /* by using tlb_cache_read()/tlb_cache_write()*/
@@ -121,6 +127,11 @@ int tlbwrite(struct pcb_t * proc, BYTE data,
   /* by using tlb_cache_read()/tlb_cache_write()
   frmnum is return value of tlb_cache_read/write value*/
 
+  if (frmnum < 0)
+    proc->perf.tlb_misses++;
+  else
+    proc->perf.tlb_hits++;
+
 #ifdef IODUMP
   // Print whether TLB hit or miss for debugging
   if (frmnum >= 0)
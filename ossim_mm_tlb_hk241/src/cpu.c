@@ -2,10 +2,8 @@
 #include "cpu.h"
 #include "mem.h"
 #include "mm.h"
-
-int calc(struct pcb_t * proc) {
-	return ((unsigned long)proc & 0UL);
-}
+#include <stdio.h>
+#include <string.h>
 
 int alloc(struct pcb_t * proc, uint32_t size, uint32_t reg_index) {
 	addr_t addr = alloc_mem(size, proc);
@@ -28,8 +26,9 @@ int read(
 		uint32_t destination) { // Index of destination register
 	
 	BYTE data;
-	if (read_mem(proc->regs[source] + offset, proc,	&data)) {
-		proc->regs[destination] = data;
+	if (read_mem(proc->regs[source] + offset, proc,	&data) == 0) {
+		if (destination < NR_REGS)
+			proc->regs[destination] = data;
 		return 0;		
 	}else{
 		return 1;
@@ -45,60 +44,455 @@ int write(
 	return write_mem(proc->regs[destination] + offset, proc, data);
 } 
 
-int run(struct pcb_t * proc) {
-	/* Check if Program Counter point to the proper instruction */
-	if (proc->pc >= proc->code->size) {
-		return 1;
+/*
+ * Instruction handlers
+ * run() calls the handler of the opcode in the table of the backend
+ * picked by set_mm_backend(), without copying the instruction. Programs
+ * hold no pointer to it, so their code can be mapped from a file.
+ */
+static int exec_alloc(struct pcb_t * proc, const struct inst_t * ins) {
+	return alloc(proc, ins->arg_0, ins->arg_1);
+}
+
+static int exec_free(struct pcb_t * proc, const struct inst_t * ins) {
+	return free_data(proc, ins->arg_0);
+}
+
+static int exec_read(struct pcb_t * proc, const struct inst_t * ins) {
+	return read(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+}
+
+static int exec_write(struct pcb_t * proc, const struct inst_t * ins) {
+	return write(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+}
+
+/* Bulk instructions on the flat memory, a byte at a time */
+static int exec_memset(struct pcb_t * proc, const struct inst_t * ins) {
+	addr_t base = proc->regs[ins->arg_0] + ins->arg_1;
+	uint32_t i;
+
+	for (i = 0; i < ins->arg_2; i++)
+		if (write_mem(base + i, proc, ins->arg_3) != 0)
+			return 1;
+	return 0;
+}
+
+static int exec_memcpy(struct pcb_t * proc, const struct inst_t * ins) {
+	addr_t src = proc->regs[ins->arg_0] + ins->arg_1;
+	addr_t dst = proc->regs[ins->arg_2] + ins->arg_3;
+	uint32_t i, n = ins->arg_4;
+	BYTE data;
+
+	/* Backwards when the destination overlaps the end of the source */
+	for (i = 0; i < n; i++) {
+		uint32_t k = (dst > src && dst < src + n) ? n - 1 - i : i;
+		if (read_mem(src + k, proc, &data) != 0
+				|| write_mem(dst + k, proc, data) != 0)
+			return 1;
 	}
-	
-	struct inst_t ins = proc->code->text[proc->pc];
-	proc->pc++;
-	int stat = 1;
-	switch (ins.opcode) {
-	case CALC:
-		stat = calc(proc);
-		break;
-	case ALLOC:
-#ifdef CPU_TLB 
-		stat = tlballoc(proc, ins.arg_0, ins.arg_1);
-#elif defined(MM_PAGING)
-		stat = pgalloc(proc, ins.arg_0, ins.arg_1);
-#else
-		stat = alloc(proc, ins.arg_0, ins.arg_1);
-#endif
-		break;
-	case FREE:
+	return 0;
+}
+
+static int exec_readn(struct pcb_t * proc, const struct inst_t * ins) {
+	addr_t base = proc->regs[ins->arg_0] + ins->arg_1;
+	uint32_t i;
+	BYTE data;
+
+	for (i = 0; i < ins->arg_2; i++)
+		if (read_mem(base + i, proc, &data) != 0)
+			return 1;
+	return 0;
+}
+
+static int exec_writen(struct pcb_t * proc, const struct inst_t * ins) {
+	addr_t base = proc->regs[ins->arg_0] + ins->arg_1;
+	uint32_t i;
+
+	for (i = 0; i < ins->arg_2; i++)
+		if (write_mem(base + i, proc, (BYTE)(ins->arg_3 + i)) != 0)
+			return 1;
+	return 0;
+}
+
 #ifdef CPU_TLB
-		stat = tlbfree_data(proc, ins.arg_0);
-#elif defined(MM_PAGING)
-		stat = pgfree_data(proc, ins.arg_0);
-#else
-		stat = free_data(proc, ins.arg_0);
+static int exec_tlballoc(struct pcb_t * proc, const struct inst_t * ins) {
+	return tlballoc(proc, ins->arg_0, ins->arg_1);
+}
+
+static int exec_tlbfree(struct pcb_t * proc, const struct inst_t * ins) {
+	return tlbfree_data(proc, ins->arg_0);
+}
+
+static int exec_tlbread(struct pcb_t * proc, const struct inst_t * ins) {
+	return tlbread(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+}
+
+static int exec_tlbwrite(struct pcb_t * proc, const struct inst_t * ins) {
+	return tlbwrite(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+}
 #endif
-		break;
-	case READ:
-#ifdef CPU_TLB
-		stat = tlbread(proc, ins.arg_0, ins.arg_1, ins.arg_2);
-#elif defined(MM_PAGING)
-		stat = pgread(proc, ins.arg_0, ins.arg_1, ins.arg_2);
-#else
-		stat = read(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+
+#ifdef MM_PAGING
+static int exec_pgalloc(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgalloc(proc, ins->arg_0, ins->arg_1);
+}
+
+static int exec_pgfree(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgfree_data(proc, ins->arg_0);
+}
+
+static int exec_pgread(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgread(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+}
+
+static int exec_pgwrite(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgwrite(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+}
+
+static int exec_pgmemset(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgmemset(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3);
+}
+
+static int exec_pgmemcpy(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgmemcpy(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3,
+		ins->arg_4);
+}
+
+static int exec_pgreadn(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgreadn(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+}
+
+static int exec_pgwriten(struct pcb_t * proc, const struct inst_t * ins) {
+	return pgwriten(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3);
+}
 #endif
-		break;
-	case WRITE:
+
+/* Handlers of every opcode, the memory ones differ between backends */
+struct mm_backend_t {
+	const char * name;
+	exec_t exec[NR_OPCODES];
+};
+
+static const struct mm_backend_t * backend;
+
+/* Only uses the CPU, the same for every backend */
+static int exec_calc(struct pcb_t * proc, const struct inst_t * ins) {
+	return ((unsigned long)proc & 0UL);
+}
+
+/* Fused pairs run one part per step, with the handlers of the backend */
+static int exec_alloc_write(struct pcb_t * proc, const struct inst_t * ins) {
+	struct inst_t part;
+
+	if (proc->rep == 0) {
+		part.arg_0 = ins->arg_0;	// Size
+		part.arg_1 = ins->arg_1;	// Region
+		return backend->exec[ALLOC](proc, &part);
+	}
+	part.arg_0 = ins->arg_2;	// Data
+	part.arg_1 = ins->arg_1;
+	part.arg_2 = ins->arg_3;	// Offset
+	return backend->exec[WRITE](proc, &part);
+}
+
+static int exec_write_read(struct pcb_t * proc, const struct inst_t * ins) {
+	struct inst_t part;
+
+	if (proc->rep == 0) {
+		part.arg_0 = ins->arg_0;	// Data
+		part.arg_1 = ins->arg_1;	// Region
+		part.arg_2 = ins->arg_2;	// Offset written
+		return backend->exec[WRITE](proc, &part);
+	}
+	part.arg_0 = ins->arg_1;
+	part.arg_1 = ins->arg_3;	// Offset read
+	part.arg_2 = ins->arg_4;	// Destination
+	return backend->exec[READ](proc, &part);
+}
+
+/*
+ * Control flow
+ * The loader has checked the targets and matched each LOOP with its
+ * ENDLOOP: arg_1 of a LOOP and arg_0 of an ENDLOOP point to each other.
+ * A jump may leave or enter a loop, the loop stack is fixed up by the
+ * next LOOP or ENDLOOP it meets.
+ */
+static int exec_jump(struct pcb_t * proc, const struct inst_t * ins) {
+	proc->pc = ins->arg_0;
+	return 0;
+}
+
+static int exec_jz(struct pcb_t * proc, const struct inst_t * ins) {
+	proc->pc = proc->regs[ins->arg_0] == 0 ? ins->arg_1 : proc->pc + 1;
+	return 0;
+}
+
+static int exec_jnz(struct pcb_t * proc, const struct inst_t * ins) {
+	proc->pc = proc->regs[ins->arg_0] != 0 ? ins->arg_1 : proc->pc + 1;
+	return 0;
+}
+
+static int exec_loop(struct pcb_t * proc, const struct inst_t * ins) {
+	uint32_t start = proc->pc;
+
+	/* Drop the loops a jump took the pc out of, this one included */
+	while (proc->nr_loops > 0) {
+		uint32_t top = proc->loop_pc[proc->nr_loops - 1];
+		if (top < start && start < proc->code->text[top].arg_1)
+			break;
+		proc->nr_loops--;
+	}
+	if (ins->arg_0 == 0) {
+		proc->pc = ins->arg_1 + 1;
+		return 0;
+	}
+	proc->loop_pc[proc->nr_loops] = start;
+	proc->loop_left[proc->nr_loops] = ins->arg_0;
+	proc->nr_loops++;
+	proc->pc = start + 1;
+	return 0;
+}
+
+static int exec_endloop(struct pcb_t * proc, const struct inst_t * ins) {
+	uint32_t start = ins->arg_0;
+
+	/* Drop the loops inside this one a jump took the pc out of */
+	while (proc->nr_loops > 0 &&
+	       proc->loop_pc[proc->nr_loops - 1] > start)
+		proc->nr_loops--;
+	if (proc->nr_loops == 0 || proc->loop_pc[proc->nr_loops - 1] != start) {
+		/* Jumped into the body from outside, run it once */
+		proc->pc++;
+	} else if (--proc->loop_left[proc->nr_loops - 1] > 0) {
+		proc->pc = start + 1;
+	} else {
+		proc->nr_loops--;
+		proc->pc++;
+	}
+	return 0;
+}
+
+/* Handlers of the instructions every backend shares */
+#define COMMON_EXEC \
+	[CALC] = exec_calc, \
+	[JUMP] = exec_jump, \
+	[JZ] = exec_jz, \
+	[JNZ] = exec_jnz, \
+	[LOOP] = exec_loop, \
+	[ENDLOOP] = exec_endloop, \
+	[ALLOC_WRITE] = exec_alloc_write, \
+	[WRITE_READ] = exec_write_read
+
+/* The first one built in is the default, the order the old #ifdef chain
+ * of run() picked them in */
+static const struct mm_backend_t backends[] = {
 #ifdef CPU_TLB
-		stat = tlbwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
-#elif defined(MM_PAGING)
-		stat = pgwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
-#else
-		stat = write(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	{ "tlb", { COMMON_EXEC, [ALLOC] = exec_tlballoc, [FREE] = exec_tlbfree,
+		[READ] = exec_tlbread, [WRITE] = exec_tlbwrite,
+#ifdef MM_PAGING
+		[MEMSET] = exec_pgmemset, [MEMCPY] = exec_pgmemcpy,
+		[READN] = exec_pgreadn, [WRITEN] = exec_pgwriten,
+#endif
+	} },
+#endif
+#ifdef MM_PAGING
+	{ "paging", { COMMON_EXEC, [ALLOC] = exec_pgalloc, [FREE] = exec_pgfree,
+		[READ] = exec_pgread, [WRITE] = exec_pgwrite,
+		[MEMSET] = exec_pgmemset, [MEMCPY] = exec_pgmemcpy,
+		[READN] = exec_pgreadn, [WRITEN] = exec_pgwriten } },
 #endif
-		break;
+	{ "legacy", { COMMON_EXEC, [ALLOC] = exec_alloc, [FREE] = exec_free,
+		[READ] = exec_read, [WRITE] = exec_write,
+		[MEMSET] = exec_memset, [MEMCPY] = exec_memcpy,
+		[READN] = exec_readn, [WRITEN] = exec_writen } },
+};
+
+static const struct mm_backend_t * backend = &backends[0];
+
+int set_mm_backend(const char * name) {
+	int i;
+	for (i = 0; i < (int)(sizeof(backends) / sizeof(backends[0])); i++) {
+		if (!strcmp(backends[i].name, name)) {
+			backend = &backends[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Cost model
+ * Time slots an instruction keeps the CPU for: its opcode, plus the
+ * penalties of the TLB misses, page faults and swaps it caused. By
+ * default each instruction takes one slot and there is no penalty.
+ */
+static struct {
+	uint32_t op[NR_OPCODES];
+	uint32_t tlb_miss;
+	uint32_t page_fault;	// Trap into pg_getpage() for a page not in MEMRAM
+	uint32_t swap_in;	// Per page copied from swap to MEMRAM
+	uint32_t swap_out;	// Per page copied from MEMRAM to swap
+} cost = {
+	.op = {
+		[CALC] = 1, [ALLOC] = 1, [FREE] = 1, [READ] = 1, [WRITE] = 1,
+		[MEMSET] = 1, [MEMCPY] = 1, [READN] = 1, [WRITEN] = 1,
+	},
+};
+
+/* Entries of a cost model file, the opcodes as in program files */
+static const struct {
+	const char * name;
+	uint32_t * slots;
+	uint32_t min;
+} cost_entry[] = {
+	{ "calc", &cost.op[CALC], 1 },
+	{ "alloc", &cost.op[ALLOC], 1 },
+	{ "free", &cost.op[FREE], 1 },
+	{ "read", &cost.op[READ], 1 },
+	{ "write", &cost.op[WRITE], 1 },
+	{ "memset", &cost.op[MEMSET], 1 },
+	{ "memcpy", &cost.op[MEMCPY], 1 },
+	{ "readn", &cost.op[READN], 1 },
+	{ "writen", &cost.op[WRITEN], 1 },
+	{ "tlb_miss", &cost.tlb_miss, 0 },
+	{ "page_fault", &cost.page_fault, 0 },
+	{ "swap_in", &cost.swap_in, 0 },
+	{ "swap_out", &cost.swap_out, 0 },
+};
+
+int load_cost_model(const char * path) {
+	FILE * file;
+	char name[32];
+	unsigned int slots;
+	int i, n = sizeof(cost_entry) / sizeof(cost_entry[0]);
+
+	if ((file = fopen(path, "r")) == NULL) {
+		printf("Cannot find cost model at %s\n", path);
+		return -1;
+	}
+	while (fscanf(file, "%31s %u", name, &slots) == 2) {
+		for (i = 0; i < n; i++)
+			if (!strcmp(cost_entry[i].name, name))
+				break;
+		if (i == n) {
+			printf("%s: unknown cost %s\n", path, name);
+			goto fail;
+		}
+		if (slots < cost_entry[i].min) {
+			printf("%s: %s takes at least %u time slot\n",
+				path, name, cost_entry[i].min);
+			goto fail;
+		}
+		*cost_entry[i].slots = slots;
+	}
+	if (!feof(file)) {
+		printf("%s: expected a name and a number of time slots\n", path);
+		goto fail;
+	}
+	fclose(file);
+	return 0;
+fail:
+	fclose(file);
+	return -1;
+}
+
+/* Opcode of the step of [ins] at [rep], fused pairs cost as their parts */
+static enum ins_opcode_t step_opcode(const struct inst_t * ins, uint32_t rep) {
+	switch (ins->opcode) {
+	case ALLOC_WRITE:
+		return rep == 0 ? ALLOC : WRITE;
+	case WRITE_READ:
+		return rep == 0 ? WRITE : READ;
 	default:
-		stat = 1;
+		return ins->opcode;
+	}
+}
+
+/* Control flow instructions run() follows at most, so that a loop with
+ * nothing else in it still takes up time slots */
+#define MAX_BRANCHES	64
+
+static int is_branch(enum ins_opcode_t opcode) {
+	return opcode >= JUMP && opcode <= ENDLOOP;
+}
+
+/* Run the control flow instructions from the pc on, return 1 if there
+ * were more than MAX_BRANCHES of them */
+static int follow(struct pcb_t * proc) {
+	int n;
+
+	for (n = 0; n < MAX_BRANCHES; n++) {
+		const struct inst_t * ins;
+
+		if (proc->pc >= proc->code->size)
+			return 0;
+		ins = &proc->code->text[proc->pc];
+		if (!is_branch(ins->opcode))
+			return 0;
+		backend->exec[ins->opcode](proc, ins);
+		proc->perf.retired[ins->opcode]++;
 	}
-	return stat;
+	return 1;
+}
 
+int run(struct pcb_t * proc) {
+	const struct inst_t * ins;
+	struct perf_stat_t * perf = &proc->perf;
+	uint32_t tlb_misses = perf->tlb_misses;
+	uint32_t major_faults = perf->major_faults;
+	uint32_t swap_ins = perf->swap_ins;
+	uint32_t swap_outs = perf->swap_outs;
+	enum ins_opcode_t opcode;
+	uint32_t slots;
+
+	if (follow(proc))
+		return 1;
+	/* Check if Program Counter point to the proper instruction */
+	if (proc->pc >= proc->code->size) {
+		return 1;
+	}
+	ins = &proc->code->text[proc->pc];
+	opcode = step_opcode(ins, proc->rep);
+	backend->exec[ins->opcode](proc, ins);
+	perf->retired[opcode]++;
+	slots = cost.op[opcode]
+		+ (perf->tlb_misses - tlb_misses) * cost.tlb_miss
+		+ (perf->major_faults - major_faults) * cost.page_fault
+		+ (perf->swap_ins - swap_ins) * cost.swap_in
+		+ (perf->swap_outs - swap_outs) * cost.swap_out;
+	/* A fused instruction stays at the pc until its last step */
+	if (++proc->rep == ins->steps) {
+		proc->rep = 0;
+		proc->pc++;
+		/* So that a program ending on a jump or an endloop finishes
+		 * along with its last instruction */
+		follow(proc);
+	}
+	return slots;
 }
 
+int run_calc(struct pcb_t * proc, int max) {
+	uint32_t slots = cost.op[CALC];
+	int n = 0;
 
+	while (n < max && proc->pc < proc->code->size) {
+		const struct inst_t * ins = &proc->code->text[proc->pc];
+		uint32_t k = ins->steps - proc->rep;
+		/* The last one may go past max, it is not cut short */
+		uint32_t left = (max - n + slots - 1) / slots;
+
+		if (ins->opcode != CALC)
+			break;
+		if (k > left)
+			k = left;
+		n += k * slots;
+		proc->rep += k;
+		proc->perf.retired[CALC] += k;
+		if (proc->rep == ins->steps) {
+			proc->rep = 0;
+			proc->pc++;
+			follow(proc);
+		}
+	}
+	return n;
+}
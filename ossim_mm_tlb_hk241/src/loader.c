@@ -1,8 +1,14 @@
 
 #include "loader.h"
+#include "tokenizer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static uint32_t avail_pid = 1;
 
@@ -11,79 +17,464 @@ static uint32_t avail_pid = 1;
 #define OPT_FREE	"free"
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
+#define OPT_MEMSET	"memset"
+#define OPT_MEMCPY	"memcpy"
+#define OPT_READN	"readn"
+#define OPT_WRITEN	"writen"
+#define OPT_JUMP	"jump"
+#define OPT_JZ		"jz"
+#define OPT_JNZ		"jnz"
+#define OPT_LOOP	"loop"
+#define OPT_ENDLOOP	"endloop"
 
-static enum ins_opcode_t get_opcode(char * opt) {
-	if (!strcmp(opt, OPT_CALC)) {
-		return CALC;
-	}else if (!strcmp(opt, OPT_ALLOC)) {
-		return ALLOC;
-	}else if (!strcmp(opt, OPT_FREE)) {
-		return FREE;
-	}else if (!strcmp(opt, OPT_READ)) {
-		return READ;
-	}else if (!strcmp(opt, OPT_WRITE)) {
-		return WRITE;
-	}else{
-		printf("Opcode: %s\n", opt);
+/* Program file name and number of arguments of the opcodes */
+static const struct {
+	const char * name;
+	int nr_args;
+} opts[NR_OPCODES] = {
+	[CALC] = { OPT_CALC, 0 },
+	[ALLOC] = { OPT_ALLOC, 2 },
+	[FREE] = { OPT_FREE, 1 },
+	[READ] = { OPT_READ, 3 },
+	[WRITE] = { OPT_WRITE, 3 },
+	[MEMSET] = { OPT_MEMSET, 4 },
+	[MEMCPY] = { OPT_MEMCPY, 5 },
+	[READN] = { OPT_READN, 3 },
+	[WRITEN] = { OPT_WRITEN, 4 },
+	[JUMP] = { OPT_JUMP, 1 },
+	[JZ] = { OPT_JZ, 2 },
+	[JNZ] = { OPT_JNZ, 2 },
+	[LOOP] = { OPT_LOOP, 1 },
+	[ENDLOOP] = { OPT_ENDLOOP, 0 },
+};
+
+static enum ins_opcode_t get_opcode(struct tokenizer_t * tok) {
+	const char * opt;
+	size_t len = tok_word(tok, &opt);
+	int op;
+
+	for (op = 0; op < NR_OPCODES; op++)
+		if (opts[op].name != NULL && !strncmp(opt, opts[op].name, len) &&
+		    opts[op].name[len] == '\0')
+			return op;
+	tok_error(tok, "unknown opcode '%.*s'", (int)len, opt);
+}
+
+/*
+ * Match every loop with its endloop and check the branch targets. A
+ * target is the index of an instruction in the program, from 0, or its
+ * size to jump to the end.
+ */
+static void link_branches(struct code_seg_t * code, const char * path) {
+	struct inst_t * text = code->text;
+	uint32_t open[MAX_LOOP_DEPTH];
+	uint32_t i, depth = 0;
+
+	for (i = 0; i < code->size; i++) {
+		struct inst_t * ins = &text[i];
+
+		switch (ins->opcode) {
+		case JUMP:
+			if (ins->arg_0 > code->size)
+				goto bad_target;
+			break;
+		case JZ:
+		case JNZ:
+			if (ins->arg_0 >= NR_REGS) {
+				printf("%s: instruction %u uses register %u\n",
+					path, i, ins->arg_0);
+				exit(1);
+			}
+			if (ins->arg_1 > code->size)
+				goto bad_target;
+			break;
+		case LOOP:
+			if (depth == MAX_LOOP_DEPTH) {
+				printf("%s: loops nested deeper than %d\n",
+					path, MAX_LOOP_DEPTH);
+				exit(1);
+			}
+			open[depth++] = i;
+			break;
+		case ENDLOOP:
+			if (depth == 0) {
+				printf("%s: endloop %u without a loop\n",
+					path, i);
+				exit(1);
+			}
+			ins->arg_0 = open[--depth];
+			text[ins->arg_0].arg_1 = i;
+			break;
+		default:
+			break;
+		}
+	}
+	if (depth > 0) {
+		printf("%s: loop %u without an endloop\n", path, open[depth - 1]);
 		exit(1);
 	}
+	return;
+bad_target:
+	printf("%s: instruction %u jumps past the end\n", path, i);
+	exit(1);
 }
 
-struct pcb_t * load(const char * path) {
-	/* Create new PCB for the new process */
-	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
-	proc->page_table =
-		(struct page_table_t*)malloc(sizeof(struct page_table_t));
-	proc->bp = PAGE_SIZE;
-	proc->pc = 0;
+#ifdef INST_FUSION
+/*
+ * Fuse runs of calc into one instruction, and an ALLOC or a WRITE
+ * followed by an access to the same region into a pair. A fused
+ * instruction takes a time slot per instruction it stands for, run()
+ * keeps it at the pc until its last step. Nothing is fused into an
+ * instruction a branch goes to, and the targets are moved to the
+ * fused indexes.
+ */
+static void fuse(struct code_seg_t * code) {
+	struct inst_t * text = code->text;
+	uint8_t * target = (uint8_t *)calloc(code->size + 1, sizeof(uint8_t));
+	uint32_t * map = (uint32_t *)malloc((code->size + 1) * sizeof(uint32_t));
+	uint32_t i = 0, n = 0;
 
+	for (i = 0; i < code->size; i++) {
+		switch (text[i].opcode) {
+		case JUMP:
+			target[text[i].arg_0] = 1;
+			break;
+		case JZ:
+		case JNZ:
+			target[text[i].arg_1] = 1;
+			break;
+		case LOOP:
+			target[i + 1] = 1;
+			target[text[i].arg_1 + 1] = 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	i = 0;
+	while (i < code->size) {
+		struct inst_t ins = text[i];
+		struct inst_t * next = i + 1 < code->size && !target[i + 1] ?
+			&text[i + 1] : NULL;
+
+		map[i] = n;
+		if (ins.opcode == CALC) {
+			while (i + ins.steps < code->size &&
+			       text[i + ins.steps].opcode == CALC &&
+			       !target[i + ins.steps])
+				ins.steps++;
+		} else if (ins.opcode == ALLOC && next != NULL &&
+			   next->opcode == WRITE && next->arg_1 == ins.arg_1) {
+			ins.opcode = ALLOC_WRITE;
+			ins.arg_2 = next->arg_0;
+			ins.arg_3 = next->arg_2;
+			ins.steps = 2;
+		} else if (ins.opcode == WRITE && next != NULL &&
+			   next->opcode == READ && next->arg_0 == ins.arg_1) {
+			ins.opcode = WRITE_READ;
+			ins.arg_3 = next->arg_1;
+			ins.arg_4 = next->arg_2;
+			ins.steps = 2;
+		}
+		i += ins.steps;
+		text[n++] = ins;
+	}
+	map[code->size] = n;
+	code->size = n;
+
+	for (i = 0; i < n; i++) {
+		struct inst_t * ins = &text[i];
+
+		switch (ins->opcode) {
+		case JUMP:
+		case ENDLOOP:
+			ins->arg_0 = map[ins->arg_0];
+			break;
+		case JZ:
+		case JNZ:
+		case LOOP:
+			ins->arg_1 = map[ins->arg_1];
+			break;
+		default:
+			break;
+		}
+	}
+	free(target);
+	free(map);
+}
+#endif
+
+/* Read the program at [path] into a code segment ready to run */
+static struct code_seg_t * parse(const char * path) {
 	/* Read process code from file */
-	FILE * file;
-	if ((file = fopen(path, "r")) == NULL) {
+	struct tokenizer_t tok;
+	if (tok_open(&tok, path) != 0) {
 		printf("Cannot find process description at '%s'\n", path);
 		exit(1);		
 	}
-	char opcode[10];
-	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
-	proc->code->text = (struct inst_t*)malloc(
-		sizeof(struct inst_t) * proc->code->size
-	);
+	struct code_seg_t * code =
+		(struct code_seg_t*)malloc(sizeof(struct code_seg_t));
+	code->priority = tok_number(&tok, "priority", UINT32_MAX);
+	code->size = tok_number(&tok, "number of instructions", UINT32_MAX);
+	tok_end_line(&tok);
+	code->text = (struct inst_t*)calloc(code->size, sizeof(struct inst_t));
+	/* Lines after the last instruction are ignored, a program shorter
+	 * than it says runs what it has */
 	uint32_t i = 0;
-	for (i = 0; i < proc->code->size; i++) {
-		fscanf(file, "%s", opcode);
-		proc->code->text[i].opcode = get_opcode(opcode);
-		switch(proc->code->text[i].opcode) {
+	for (i = 0; i < code->size; i++) {
+		struct inst_t * ins = &code->text[i];
+		uint32_t arg[5] = { 0 };
+		int k;
+
+		if (tok_eof(&tok)) {
+			tok_warning(&tok, "expected %u instructions, found %u",
+				code->size, i);
+			code->size = i;
+			break;
+		}
+		ins->opcode = get_opcode(&tok);
+		ins->steps = 1;
+		for (k = 0; k < opts[ins->opcode].nr_args; k++)
+			arg[k] = tok_number(&tok, "argument", UINT32_MAX);
+		tok_end_line(&tok);
+		ins->arg_0 = arg[0];
+		ins->arg_1 = arg[1];
+		ins->arg_2 = arg[2];
+		ins->arg_3 = arg[3];
+		ins->arg_4 = arg[4];
+	}
+	tok_close(&tok);
+	link_branches(code, path);
+#ifdef INST_FUSION
+	fuse(code);
+#endif
+	code->map = NULL;
+	return code;
+}
+
+/*
+ * The mapped [code] is read only and came from anywhere: check every
+ * instruction can run, the way link_branches() left them. A LOOP and its
+ * ENDLOOP point to each other and are nested like brackets.
+ */
+static void check_program(struct code_seg_t * code, const char * path) {
+	const struct inst_t * text = code->text;
+	uint32_t open[MAX_LOOP_DEPTH];
+	uint32_t i, depth = 0;
+
+	for (i = 0; i < code->size; i++) {
+		const struct inst_t * ins = &text[i];
+		uint32_t steps = 1;
+
+		if (ins->opcode >= NR_OPCODES) {
+			printf("%s: instruction %u has unknown opcode %u\n",
+				path, i, ins->opcode);
+			exit(1);
+		}
+		switch (ins->opcode) {
 		case CALC:
+			steps = ins->steps > 0 ? ins->steps : 1;
+			break;
+		case ALLOC_WRITE:
+		case WRITE_READ:
+			steps = 2;
+			break;
+		case JUMP:
+			if (ins->arg_0 > code->size)
+				goto bad_target;
+			break;
+		case JZ:
+		case JNZ:
+			if (ins->arg_0 >= NR_REGS || ins->arg_1 > code->size)
+				goto bad_target;
+			break;
+		case LOOP:
+			if (depth == MAX_LOOP_DEPTH || ins->arg_1 >= code->size)
+				goto bad_target;
+			open[depth++] = i;
+			break;
+		case ENDLOOP:
+			if (depth == 0 || ins->arg_0 != open[depth - 1] ||
+			    text[ins->arg_0].arg_1 != i)
+				goto bad_target;
+			depth--;
 			break;
-		case ALLOC:
-			fscanf(
-				file,
-				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
-			);
-			break;
-		case FREE:
-			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
-			break;
-		case READ:
-		case WRITE:
-			fscanf(
-				file,
-				"%u %u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1,
-				&proc->code->text[i].arg_2
-			);
-			break;	
 		default:
-			printf("Opcode: %s\n", opcode);
+			break;
+		}
+		if (ins->steps != steps) {
+			printf("%s: instruction %u stands for %u steps\n",
+				path, i, ins->steps);
 			exit(1);
 		}
 	}
+	if (depth > 0) {
+		i = open[depth - 1];
+		goto bad_target;
+	}
+	return;
+bad_target:
+	printf("%s: instruction %u has a bad register or target\n", path, i);
+	exit(1);
+}
+
+/*
+ * Map the binary program file at [path], NULL if it is not one. The
+ * instructions are used where they are mapped, progbin already linked
+ * and fused them so they are only checked once.
+ */
+static struct code_seg_t * map_program(const char * path) {
+	struct prog_header_t hdr;
+	struct code_seg_t * code;
+	struct stat st;
+	void * map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		printf("Cannot find process description at '%s'\n", path);
+		exit(1);
+	}
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, PROG_MAGIC, sizeof(hdr.magic))) {
+		close(fd);
+		return NULL;
+	}
+	if (hdr.version != PROG_VERSION ||
+	    hdr.inst_size != sizeof(struct inst_t) ||
+	    hdr.flags != PROG_FLAGS) {
+		printf("%s: built for another version or configuration of "
+			"the simulator, run progbin again\n", path);
+		exit(1);
+	}
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size !=
+	    sizeof(hdr) + (uint64_t)hdr.size * sizeof(struct inst_t)) {
+		printf("%s: truncated binary program\n", path);
+		exit(1);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("%s: cannot map binary program\n", path);
+		exit(1);
+	}
+	code = (struct code_seg_t *)malloc(sizeof(struct code_seg_t));
+	code->text = (struct inst_t *)((char *)map + sizeof(hdr));
+	code->size = hdr.size;
+	code->priority = hdr.priority;
+	code->map = map;
+	code->map_len = st.st_size;
+	check_program(code, path);
+	return code;
+}
+
+int save_program(const char * path, const char * out) {
+	struct code_seg_t * code = parse(path);
+	struct prog_header_t hdr;
+	FILE * file;
+	int err = 0;
+
+	memcpy(hdr.magic, PROG_MAGIC, sizeof(hdr.magic));
+	hdr.version = PROG_VERSION;
+	hdr.inst_size = sizeof(struct inst_t);
+	hdr.flags = PROG_FLAGS;
+	hdr.priority = code->priority;
+	hdr.size = code->size;
+	if ((file = fopen(out, "wb")) == NULL) {
+		err = -1;
+	} else {
+		if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+		    fwrite(code->text, sizeof(struct inst_t), code->size,
+		    file) != code->size)
+			err = -1;
+		if (fclose(file) != 0)
+			err = -1;
+	}
+	free(code->text);
+	free(code);
+	return err;
+}
+
+/*
+ * Code segment cache
+ * The processes of the same program file share one code segment, it is
+ * read only once they run. The first load() of a path parses it, the
+ * next ones take a reference, release_code() frees it after the last.
+ */
+#define CODE_CACHE_SZ	64
+
+static struct code_seg_t * code_cache[CODE_CACHE_SZ];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_path(const char * path) {
+	uint32_t h = 5381;
+	while (*path)
+		h = h * 33 + (unsigned char)*path++;
+	return h % CODE_CACHE_SZ;
+}
+
+static struct code_seg_t * get_code(const char * path) {
+	struct code_seg_t ** bucket = &code_cache[hash_path(path)];
+	struct code_seg_t * code;
+
+	pthread_mutex_lock(&cache_lock);
+	for (code = *bucket; code != NULL; code = code->next)
+		if (!strcmp(code->path, path))
+			break;
+	if (code == NULL) {
+		code = map_program(path);
+		if (code == NULL)
+			code = parse(path);
+		code->path = strdup(path);
+		code->refs = 0;
+		code->next = *bucket;
+		*bucket = code;
+	}
+	code->refs++;
+	pthread_mutex_unlock(&cache_lock);
+	return code;
+}
+
+void release_code(struct code_seg_t * code) {
+	struct code_seg_t ** it;
+
+	pthread_mutex_lock(&cache_lock);
+	if (--code->refs > 0) {
+		pthread_mutex_unlock(&cache_lock);
+		return;
+	}
+	for (it = &code_cache[hash_path(code->path)]; *it != code;
+	     it = &(*it)->next)
+		;
+	*it = code->next;
+	pthread_mutex_unlock(&cache_lock);
+	if (code->map != NULL)
+		munmap(code->map, code->map_len);
+	else
+		free(code->text);
+	free(code->path);
+	free(code);
+}
+
+struct pcb_t * load(const char * path) {
+	/* Create new PCB for the new process */
+	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
+	proc->pid = avail_pid;
+	avail_pid++;
+	proc->page_table =
+		(struct page_table_t*)malloc(sizeof(struct page_table_t));
+	proc->bp = PAGE_SIZE;
+	proc->pc = 0;
+	proc->rep = 0;
+	proc->nr_loops = 0;
+	memset(proc->regs, 0, sizeof(proc->regs));
+	proc->last_cpu = -1;
+	proc->migrations = 0;
+	memset(&proc->perf, 0, sizeof(proc->perf));
+	proc->quantum = 0;
+
+	proc->code = get_code(path);
+	proc->priority = proc->code->priority;
 	return proc;
 }
 
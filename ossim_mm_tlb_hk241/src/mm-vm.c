@@ -81,8 +81,7 @@ int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt)
 		new_node->rg_end = rg_elmt->rg_end;
 	}
 	// Insert the new node into the list
-	if (rg_node_head != NULL)
-		new_node->rg_next = rg_node_head;
+	new_node->rg_next = rg_node_head;
 	current_vma->vm_freerg_list = new_node;
 
 	return 0;
@@ -281,7 +280,7 @@ int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
 			return -1;
 		// get vicpgn
 		uint32_t vicpte = mm->pgd[vicpgn];
-		int vicfpn = PAGING_FPN(vicpte);
+		int vicfpn = PAGING_PTE_FPN(vicpte);
 
 		/* Get free frame in MEMSWP */
 		MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
@@ -300,9 +299,13 @@ int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
 		pte_set_fpn(&mm->pgd[pgn], vicfpn);
 
 		enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
+		caller->perf.major_faults++;
+		caller->perf.swap_ins++;
+		caller->perf.swap_outs++;
+		pte = mm->pgd[pgn];
 	}
 
-	*fpn = PAGING_FPN(pte);
+	*fpn = PAGING_PTE_FPN(pte);
 
 	return 0;
 }
@@ -402,7 +405,8 @@ int pgread(
 	int val = __read(proc, 0, source, offset, &data);
 
 	// Assign the read data to destination
-	destination = (uint32_t)data;
+	if (val == 0 && destination < NR_REGS)
+		proc->regs[destination] = data;
 
 #ifdef IODUMP
 	// Print read operation details for debugging
@@ -483,6 +487,197 @@ int pgwrite(
 }
 
 
+/*
+ * Bulk memory instructions
+ * A range of a region is handled a page at a time: the page is brought
+ * to MEMRAM once, then the bytes it holds are moved with memcpy/memset
+ * instead of a pg_getval/pg_setval page lookup per byte.
+ */
+#define XFER_READ	0	// Range to buf
+#define XFER_WRITE	1	// buf to range
+#define XFER_FILL	2	// value to range
+
+/* Check that [size] bytes from [offset] lie in region [rgid] */
+static struct vm_rg_struct *get_range(struct pcb_t *caller, uint32_t rgid,
+				      uint32_t offset, uint32_t size, const char *op)
+{
+	struct vm_rg_struct *currg;
+
+	if (rgid >= PAGING_MAX_SYMTBL_SZ ||
+	    (currg = get_symrg_byid(caller->mm, rgid)) == NULL)
+		return NULL;
+	if ((unsigned long)offset + size > currg->rg_end - currg->rg_start)
+	{
+		printf("Invalid %s: region of %d range from %ld to %ld but you access %ld to %ld\n",
+			   op, rgid, currg->rg_start, currg->rg_end,
+			   currg->rg_start + offset, currg->rg_start + offset + size);
+		return NULL;
+	}
+	return currg;
+}
+
+/*pg_xfer - move [size] bytes between virtual address [addr] and [buf]
+ *@caller: caller
+ *@addr: virtual address of the first byte
+ *@buf: source or destination, unused by XFER_FILL
+ *@value: fill byte of XFER_FILL
+ */
+static int pg_xfer(struct pcb_t *caller, int addr, BYTE *buf, int size,
+		   BYTE value, int op)
+{
+	while (size > 0)
+	{
+		int pgn = PAGING_PGN(addr);
+		int off = PAGING_OFFST(addr);
+		int len = PAGING_PAGESZ - off;
+		int fpn;
+		BYTE *mem;
+
+		if (len > size)
+			len = size;
+		if (pg_getpage(caller->mm, pgn, &fpn, caller) != 0)
+			return -1; /* invalid page access */
+		mem = caller->mram->storage + (fpn << PAGING_ADDR_FPN_LOBIT) + off;
+
+		if (op == XFER_READ)
+			memcpy(buf, mem, len);
+		else if (op == XFER_WRITE)
+			memcpy(mem, buf, len);
+		else
+			memset(mem, value, len);
+		if (buf != NULL)
+			buf += len;
+		addr += len;
+		size -= len;
+	}
+	return 0;
+}
+
+#ifdef IODUMP
+#ifdef PAGETBL_DUMP
+#define bulk_dump(proc)	print_pgtbl(proc, 0, -1)
+#else
+#define bulk_dump(proc)
+#endif
+#else
+#define bulk_dump(proc)
+#endif
+
+/*pgmemset - fill [size] bytes of a region with [value] */
+int pgmemset(struct pcb_t *proc, uint32_t rgid, uint32_t offset,
+	     uint32_t size, BYTE value)
+{
+	struct vm_rg_struct *currg = get_range(proc, rgid, offset, size, "memset");
+
+	if (currg == NULL)
+		return -1;
+#ifdef IODUMP
+	printf("memset region=%d offset=%d size=%d value=%d\n",
+		   rgid, offset, size, value);
+#endif
+	bulk_dump(proc);
+	return pg_xfer(proc, currg->rg_start + offset, NULL, size, value, XFER_FILL);
+}
+
+/*pgmemcpy - copy [size] bytes between two regions, they may overlap */
+int pgmemcpy(struct pcb_t *proc, uint32_t src, uint32_t src_offset,
+	     uint32_t dst, uint32_t dst_offset, uint32_t size)
+{
+	struct vm_rg_struct *srcrg = get_range(proc, src, src_offset, size, "memcpy");
+	struct vm_rg_struct *dstrg = get_range(proc, dst, dst_offset, size, "memcpy");
+	BYTE buf[PAGING_PAGESZ];
+	int from, to, left = size, step;
+
+	if (srcrg == NULL || dstrg == NULL)
+		return -1;
+#ifdef IODUMP
+	printf("memcpy region=%d offset=%d to region=%d offset=%d size=%d\n",
+		   src, src_offset, dst, dst_offset, size);
+#endif
+	bulk_dump(proc);
+
+	from = srcrg->rg_start + src_offset;
+	to = dstrg->rg_start + dst_offset;
+	/* Through a page sized buffer, the pages of both sides need not fit
+	 * in MEMRAM together. Backwards if the end of the source would be
+	 * overwritten before it is read. */
+	if (to > from && to < from + left)
+	{
+		while (left > 0)
+		{
+			step = left < PAGING_PAGESZ ? left : PAGING_PAGESZ;
+			left -= step;
+			if (pg_xfer(proc, from + left, buf, step, 0, XFER_READ) != 0 ||
+			    pg_xfer(proc, to + left, buf, step, 0, XFER_WRITE) != 0)
+				return -1;
+		}
+		return 0;
+	}
+	while (left > 0)
+	{
+		step = left < PAGING_PAGESZ ? left : PAGING_PAGESZ;
+		if (pg_xfer(proc, from, buf, step, 0, XFER_READ) != 0 ||
+		    pg_xfer(proc, to, buf, step, 0, XFER_WRITE) != 0)
+			return -1;
+		from += step;
+		to += step;
+		left -= step;
+	}
+	return 0;
+}
+
+/*pgreadn - read [size] bytes of a region */
+int pgreadn(struct pcb_t *proc, uint32_t rgid, uint32_t offset, uint32_t size)
+{
+	struct vm_rg_struct *currg = get_range(proc, rgid, offset, size, "readn");
+	BYTE buf[PAGING_PAGESZ];
+	uint32_t sum = 0;
+	int addr, left = size, step, i;
+
+	if (currg == NULL)
+		return -1;
+	for (addr = currg->rg_start + offset; left > 0; addr += step, left -= step)
+	{
+		step = left < PAGING_PAGESZ ? left : PAGING_PAGESZ;
+		if (pg_xfer(proc, addr, buf, step, 0, XFER_READ) != 0)
+			return -1;
+		for (i = 0; i < step; i++)
+			sum += (unsigned char)buf[i];
+	}
+#ifdef IODUMP
+	printf("readn region=%d offset=%d size=%d sum=%u\n",
+		   rgid, offset, size, sum);
+#endif
+	bulk_dump(proc);
+	return 0;
+}
+
+/*pgwriten - write [size] bytes of a region, counting up from [value] */
+int pgwriten(struct pcb_t *proc, uint32_t rgid, uint32_t offset,
+	     uint32_t size, BYTE value)
+{
+	struct vm_rg_struct *currg = get_range(proc, rgid, offset, size, "writen");
+	BYTE buf[PAGING_PAGESZ];
+	int addr, left = size, step, i;
+
+	if (currg == NULL)
+		return -1;
+#ifdef IODUMP
+	printf("writen region=%d offset=%d size=%d value=%d\n",
+		   rgid, offset, size, value);
+#endif
+	bulk_dump(proc);
+	for (addr = currg->rg_start + offset; left > 0; addr += step, left -= step)
+	{
+		step = left < PAGING_PAGESZ ? left : PAGING_PAGESZ;
+		for (i = 0; i < step; i++)
+			buf[i] = value++;
+		if (pg_xfer(proc, addr, buf, step, 0, XFER_WRITE) != 0)
+			return -1;
+	}
+	return 0;
+}
+
 /*free_pcb_memphy - collect all memphy of pcb
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
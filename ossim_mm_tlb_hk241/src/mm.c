@@ -100,11 +100,17 @@ int vmap_page_range(struct pcb_t *caller, // process call
    *      in page table caller->mm->pgd[]
    */
   for (; pgit < pgnum; pgit++){
+    uint32_t nr_frames;
+
     pte_set_fpn(&caller->mm->pgd[pgn + pgit], frames->fpn);
     MEMPHY_put_usedfp(caller->mram, frames->fpn, caller->mm);
     frames = frames->fp_next;
     enlist_pgn_node(&caller->mm->fifo_pgn, pgn+pgit);
-      
+
+    caller->perf.minor_faults++;
+    nr_frames = __atomic_add_fetch(&caller->mm->nr_frames, 1, __ATOMIC_RELAXED);
+    if (nr_frames > caller->perf.peak_frames)
+      caller->perf.peak_frames = nr_frames;
   }
    /* Tracking for later page replacement activities (if needed)
     * Enqueue new usage page */
@@ -153,7 +159,7 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
       /* Find victim page */
       if (find_victim_page(caller->mm, &vicpgn) ==0) {
         vicpte = caller->mm->pgd[vicpgn];
-        vicfpn = PAGING_FPN(vicpte);
+        vicfpn = PAGING_PTE_FPN(vicpte);
         /* Remove frame from used_fp_list*/
         MEMPHY_remove_usedfp(caller->mram, vicfpn);
         /* Get free frame in MEMSWP */
@@ -161,6 +167,8 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
         /* Copy victim frame to swap */
         __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
         pte_set_swap(&caller->mm->pgd[vicpgn], 0, swpfpn);
+        caller->perf.swap_outs++;
+        __atomic_sub_fetch(&caller->mm->nr_frames, 1, __ATOMIC_RELAXED);
 
       } 
       else {
@@ -168,13 +176,15 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
         struct framephy_struct *fp = MEMPHY_get_usedfp(caller->mram);
         find_victim_page(fp->owner, &vicpgn);
         vicpte = fp->owner->pgd[vicpgn];
-        vicfpn = PAGING_FPN(vicpte);
+        vicfpn = PAGING_PTE_FPN(vicpte);
         //Testing validity
         /* Get free frame in MEMSWP */
         MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
         /* Copy victim frame to swap */
         __swap_cp_page(caller->mram, fp->fpn, caller->active_mswp, swpfpn);
         pte_set_swap(&fp->owner->pgd[vicpgn], 0, swpfpn);
+        caller->perf.swap_outs++;
+        __atomic_sub_fetch(&fp->owner->nr_frames, 1, __ATOMIC_RELAXED);
 
       } 
       if (pgit == 0) {
@@ -274,7 +284,7 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
 int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
   struct vm_area_struct * vma = malloc(sizeof(struct vm_area_struct));
-  mm->pgd = malloc(PAGING_MAX_PGN*sizeof(uint32_t));
+  mm->pgd = calloc(PAGING_MAX_PGN, sizeof(uint32_t));
 
   /* By default the owner comes with at least one vma */
   vma->vm_id = 0;
@@ -282,7 +292,9 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
   vma->vm_end = vma->vm_start;
   vma->sbrk = vma->vm_start;
   mm->fifo_pgn = NULL;
+  mm->nr_frames = 0;
   struct vm_rg_struct *first_rg = init_vm_rg(vma->vm_start, vma->vm_end);
+  vma->vm_freerg_list = NULL;
   enlist_vm_rg_node(&vma->vm_freerg_list, first_rg);
 
   vma->vm_next = NULL;
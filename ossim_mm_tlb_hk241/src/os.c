@@ -2,13 +2,19 @@
 #include "cpu.h"
 #include "timer.h"
 #include "sched.h"
+#include "sched-stat.h"
+#include "perf-stat.h"
 #include "loader.h"
+#include "tokenizer.h"
 #include "mm.h"
 
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
 
 static int time_slot;
 static int num_cpus;
@@ -33,13 +39,16 @@ struct mmpaging_ld_args {
 #endif
 
 static struct ld_args{
-	char ** path;
+	char ** path;	// Into paths
+	char * paths;
 	unsigned long * start_time;
 #ifdef MLQ_SCHED
 	unsigned long * prio;
 #endif
+	struct pcb_t ** proc;	// Loaded, waiting for their start time
 } ld_processes;
 int num_processes;
+static int nr_admitted;
 
 struct cpu_args {
 	struct timer_id_t * timer_id;
@@ -53,56 +62,118 @@ static void * cpu_routine(void * args) {
 	/* Check for new process in ready queue */
 	int time_left = 0;
 	struct pcb_t * proc = NULL;
+	/* Behaviour of the current slice, for end_slice() */
+	uint32_t slice_faults = 0;
+	int slice_calc = 1;
 	while (1) {
 		/* Check the status of current process */
 		if (proc == NULL) {
 			/* No process is running, the we load new process from
 		 	* ready queue */
-			proc = get_proc();
-			if (proc == NULL) {
-                           next_slot(timer_id);
-                           continue; /* First load failed. skip dummy load */
-                        }
-		}else if (proc->pc == proc->code->size) {
+			proc = get_proc(id);
+		}else if (proc->pc >= proc->code->size) {
 			/* The porcess has finish it job */
 			printf("\tCPU %d: Processed %2d has finished\n",
 				id ,proc->pid);
+			stat_finish(proc);
+			report_perf_stat(proc);
+			release_code(proc->code);
 			free(proc);
-			proc = get_proc();
+			proc = get_proc(id);
 			time_left = 0;
 		}else if (time_left == 0) {
 			/* The process has done its job in current time slot */
 			printf("\tCPU %d: Put process %2d to run queue\n",
 				id, proc->pid);
-			put_proc(proc);
-			proc = get_proc();
+			end_slice(proc, proc->perf.major_faults - slice_faults,
+				slice_calc);
+			put_proc(id, proc);
+			proc = get_proc(id);
+#ifdef MLQ_PREEMPT
+		}else if (need_resched(id)) {
+			/* A higher priority process was added for this CPU */
+			printf("\tCPU %d: Preempted process %2d\n",
+				id, proc->pid);
+			put_proc(id, proc);
+			proc = get_proc(id);
+			time_left = 0;
+#endif
 		}
 		
 		/* Recheck process status after loading new process */
-		if (proc == NULL && done) {
+		if (proc == NULL && done && cpu_queue_empty(id)) {
 			/* No process to run, exit */
 			printf("\tCPU %d stopped\n", id);
 			break;
 		}else if (proc == NULL) {
-			/* There may be new processes to run in
-			 * next time slots, just skip current slot */
-			next_slot(timer_id);
+			/* There may be new processes to run in next time
+			 * slots, leave the slot barrier until one shows up */
+			wait_proc(id, timer_id);
 			continue;
 		}else if (time_left == 0) {
 			printf("\tCPU %d: Dispatched process %2d\n",
 				id, proc->pid);
-			time_left = time_slot;
+			time_left = proc->quantum;
+			slice_faults = proc->perf.major_faults;
+			slice_calc = 1;
 		}
 		
+#ifdef RUN_TO_QUANTUM
+		/* A run of calc touches nothing but the process: do it at
+		 * once, then sit out of the barrier for the slots it took.
+		 * Stop at the next timed event, which may preempt us. */
+		if (proc->code->text[proc->pc].opcode == CALC) {
+			uint64_t now = current_time();
+			uint64_t until = next_event_time();
+			int n = time_left;
+
+			if (until - now < (uint64_t)n)
+				n = until - now;
+			n = run_calc(proc, n);
+			time_left = n < time_left ? time_left - n : 0;
+			if (n > 1)
+				wait_until(timer_id, now + n);
+			else
+				next_slot(timer_id);
+			continue;
+		}
+#endif
 		/* Run current process */
-		run(proc);
-		time_left--;
-		next_slot(timer_id);
+		if (proc->code->text[proc->pc].opcode != CALC)
+			slice_calc = 0;
+		/* The process keeps the CPU until the instruction is done,
+		 * past the end of its quantum if need be */
+		uint64_t now = current_time();
+		int n = run(proc);
+		time_left = n < time_left ? time_left - n : 0;
+		if (n > 1)
+			wait_until(timer_id, now + n);
+		else
+			next_slot(timer_id);
 	}
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
 
+/* Timed event of the [arg]-th process, fired at its start time along
+ * with every other process due in the same slot */
+static void admit_proc(void * arg) {
+	int i = (int)(intptr_t)arg;
+	struct pcb_t * proc = ld_processes.proc[i];
+
+	printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
+		ld_processes.path[i], proc->pid, ld_processes.prio[i]);
+	add_proc(proc);
+	if (++nr_admitted == num_processes) {
+		free(ld_processes.paths);
+		free(ld_processes.path);
+		free(ld_processes.start_time);
+		free(ld_processes.proc);
+		done = 1;
+		finish_loading();
+	}
+}
+
 static void * ld_routine(void * args) {
 #ifdef MM_PAGING
 	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
@@ -114,14 +185,13 @@ static void * ld_routine(void * args) {
 #endif
 	int i = 0;
 	printf("ld_routine\n");
+	ld_processes.proc = (struct pcb_t **)
+		malloc(sizeof(struct pcb_t *) * num_processes);
 	while (i < num_processes) {
 		struct pcb_t * proc = load(ld_processes.path[i]);
 #ifdef MLQ_SCHED
 		proc->prio = ld_processes.prio[i];
 #endif
-		while (current_time() < ld_processes.start_time[i]) {
-			next_slot(timer_id);
-		}
 #ifdef MM_PAGING
 		proc->mm = malloc(sizeof(struct mm_struct));
 		init_mm(proc->mm, proc);
@@ -129,27 +199,33 @@ static void * ld_routine(void * args) {
 		proc->mswp = mswp;
 		proc->active_mswp = active_mswp;
 #endif
-		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
-			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
-		add_proc(proc);
-		free(ld_processes.path[i]);
+		ld_processes.proc[i] = proc;
 		i++;
-		next_slot(timer_id);
 	}
-	free(ld_processes.path);
-	free(ld_processes.start_time);
-	done = 1;
+	/* The timer admits them from now on, the loader is done */
+	for (i = 0; i < num_processes; i++)
+		add_timed_event(ld_processes.start_time[i], admit_proc,
+			(void *)(intptr_t)i);
+	if (num_processes == 0) {
+		done = 1;
+		finish_loading();
+	}
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
 
+#define PROC_DIR	"input/proc/"
+
 static void read_config(const char * path) {
-	FILE * file;
-	if ((file = fopen(path, "r")) == NULL) {
+	struct tokenizer_t tok;
+	if (tok_open(&tok, path) != 0) {
 		printf("Cannot find configure file at %s\n", path);
 		exit(1);
 	}
-	fscanf(file, "%d %d %d\n", &time_slot, &num_cpus, &num_processes);
+	time_slot = tok_number(&tok, "time slot", INT_MAX);
+	num_cpus = tok_number(&tok, "number of CPUs", INT_MAX);
+	num_processes = tok_number(&tok, "number of processes", INT_MAX);
+	tok_end_line(&tok);
 	ld_processes.path = (char**)malloc(sizeof(char*) * num_processes);
 	ld_processes.start_time = (unsigned long*)
 		malloc(sizeof(unsigned long) * num_processes);
@@ -165,7 +241,8 @@ static void read_config(const char * path) {
 	 * Format:
 	 *        CPU_TLBSZ
 	*/
-	fscanf(file, "%d\n", &tlbsz);
+	tlbsz = tok_number(&tok, "TLB size", INT_MAX);
+	tok_end_line(&tok);
 #endif
 #endif
 
@@ -186,11 +263,10 @@ static void read_config(const char * path) {
 	 * Format: (size=0 result non-used memswap, must have RAM and at least 1 SWAP)
 	 *        MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
 	*/
-	fscanf(file, "%d\n", &memramsz);
+	memramsz = tok_number(&tok, "RAM size", INT_MAX);
 	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-		fscanf(file, "%d", &(memswpsz[sit])); 
-
-	fscanf(file, "\n"); /* Final character */
+		memswpsz[sit] = tok_number(&tok, "swap size", INT_MAX);
+	tok_end_line(&tok);
 #endif
 #endif
 
@@ -198,32 +274,91 @@ static void read_config(const char * path) {
 	ld_processes.prio = (unsigned long*)
 		malloc(sizeof(unsigned long) * num_processes);
 #endif
+	/* The paths are shorter than the file and a prefix each, one
+	 * allocation holds them all. Lines after the last process are
+	 * ignored, a config shorter than it says runs what it has. */
+	char * arena = (char *)malloc((size_t)num_processes *
+		(sizeof(PROC_DIR) + 1) + (tok.end - tok.buf));
+	ld_processes.paths = arena;
 	int i;
 	for (i = 0; i < num_processes; i++) {
-		ld_processes.path[i] = (char*)malloc(sizeof(char) * 100);
-		ld_processes.path[i][0] = '\0';
-		strcat(ld_processes.path[i], "input/proc/");
-		char proc[100];
+		const char * proc;
+		size_t len;
+
+		if (tok_eof(&tok)) {
+			tok_warning(&tok, "expected %d processes, found %d",
+				num_processes, i);
+			num_processes = i;
+			break;
+		}
+		ld_processes.start_time[i] =
+			tok_number(&tok, "start time", ULONG_MAX);
+		if ((len = tok_word(&tok, &proc)) == 0)
+			tok_error(&tok, "expected a program");
+		ld_processes.path[i] = arena;
+		memcpy(arena, PROC_DIR, sizeof(PROC_DIR) - 1);
+		arena += sizeof(PROC_DIR) - 1;
+		memcpy(arena, proc, len);
+		arena += len;
+		*arena++ = '\0';
 #ifdef MLQ_SCHED
-		fscanf(file, "%lu %s %lu\n", &ld_processes.start_time[i], proc, &ld_processes.prio[i]);
-#else
-		fscanf(file, "%lu %s\n", &ld_processes.start_time[i], proc);
+		ld_processes.prio[i] =
+			tok_number(&tok, "priority", MAX_PRIO - 1);
 #endif
-		strcat(ld_processes.path[i], proc);
+		tok_end_line(&tok);
 	}
+	tok_close(&tok);
+}
+
+/* [name] under input/, like every file named on the command line */
+static char * input_path(const char * name) {
+	char * path = (char *)malloc(strlen("input/") + strlen(name) + 1);
+	strcpy(path, "input/");
+	strcat(path, name);
+	return path;
+}
+
+static void usage(void) {
+	printf("Usage: os [-s mlq|fair|fifo] [-m tlb|paging|legacy] [-c cost model] [path to configure file]\n");
+	exit(1);
 }
 
 int main(int argc, char * argv[]) {
-	/* Read config */
-	if (argc != 2) {
-		printf("Usage: os [path to configure file]\n");
-		return 1;
+	int opt;
+
+	/* Read options */
+	while ((opt = getopt(argc, argv, "s:m:c:")) != -1) {
+		switch (opt) {
+		case 's':
+			if (set_sched_policy(optarg) != 0) {
+				printf("Unknown scheduling policy %s\n", optarg);
+				usage();
+			}
+			break;
+		case 'm':
+			if (set_mm_backend(optarg) != 0) {
+				printf("Unknown memory backend %s\n", optarg);
+				usage();
+			}
+			break;
+		case 'c': {
+			char * cost_path = input_path(optarg);
+			if (load_cost_model(cost_path) != 0)
+				exit(1);
+			free(cost_path);
+			break;
+		}
+		default:
+			usage();
+		}
 	}
-	char path[100];
-	path[0] = '\0';
-	strcat(path, "input/");
-	strcat(path, argv[1]);
+
+	/* Read config */
+	if (argc - optind != 1)
+		usage();
+	char * path = input_path(argv[optind]);
 	read_config(path);
+	free(path);
 
 	pthread_t * cpu = (pthread_t*)malloc(num_cpus * sizeof(pthread_t));
 	struct cpu_args * args =
@@ -279,7 +414,8 @@ int main(int argc, char * argv[]) {
 #endif
 
 	/* Init scheduler */
-	init_scheduler();
+	init_scheduler(num_cpus, num_processes, time_slot);
+	init_sched_stat(num_processes);
 
 	/* Run CPU and loader */
 #ifdef MM_PAGING
@@ -300,6 +436,8 @@ int main(int argc, char * argv[]) {
 
 	/* Stop timer */
 	stop_timer();
+	finish_scheduler();
+	report_sched_stat();
 
 	return 0;
 
@@ -0,0 +1,60 @@
+
+#include "perf-stat.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#ifdef PERF_STAT
+
+/* Opcodes of the program files, fused ones are counted as their parts */
+static const char * opcode_name[] = {
+	[CALC] = "calc",
+	[ALLOC] = "alloc",
+	[FREE] = "free",
+	[READ] = "read",
+	[WRITE] = "write",
+	[MEMSET] = "memset",
+	[MEMCPY] = "memcpy",
+	[READN] = "readn",
+	[WRITEN] = "writen",
+	[JUMP] = "jump",
+	[JZ] = "jz",
+	[JNZ] = "jnz",
+	[LOOP] = "loop",
+	[ENDLOOP] = "endloop",
+};
+
+#define NR_NAMED	(int)(sizeof(opcode_name) / sizeof(opcode_name[0]))
+
+static pthread_once_t header_once = PTHREAD_ONCE_INIT;
+
+static void print_header(void) {
+	char line[512];
+	int i, n;
+
+	n = snprintf(line, sizeof(line), "perf pid");
+	for (i = 0; i < NR_NAMED; i++)
+		n += snprintf(line + n, sizeof(line) - n, " %s", opcode_name[i]);
+	printf("%s tlb_hit tlb_miss minor_fault major_fault swap_in swap_out"
+		" peak_frames ctx_switch\n", line);
+}
+
+void report_perf_stat(struct pcb_t * proc) {
+	const struct perf_stat_t * perf = &proc->perf;
+	char line[512];
+	int i, n;
+
+	pthread_once(&header_once, print_header);
+	/* One printf, so that rows of CPUs finishing together stay whole */
+	n = snprintf(line, sizeof(line), "perf %u", proc->pid);
+	for (i = 0; i < NR_NAMED; i++)
+		n += snprintf(line + n, sizeof(line) - n, " %u",
+			perf->retired[i]);
+	printf("%s %u %u %u %u %u %u %u %u\n", line,
+		perf->tlb_hits, perf->tlb_misses,
+		perf->minor_faults, perf->major_faults,
+		perf->swap_ins, perf->swap_outs,
+		perf->peak_frames, perf->ctx_switches);
+}
+
+#endif
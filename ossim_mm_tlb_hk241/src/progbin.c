@@ -0,0 +1,17 @@
+
+#include "loader.h"
+#include <stdio.h>
+
+/* Convert a text program to the binary program file load() maps */
+int main(int argc, char * argv[]) {
+	if (argc != 3) {
+		printf("Usage: progbin [text program] [binary output]\n");
+		return 1;
+	}
+	if (save_program(argv[1], argv[2]) != 0) {
+		printf("Cannot write binary program to '%s'\n", argv[2]);
+		return 1;
+	}
+	return 0;
+}
+
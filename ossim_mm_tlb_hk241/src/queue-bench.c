@@ -0,0 +1,94 @@
+/*
+ * Queue contention microbenchmark
+ *
+ * [threads] workers share one queue holding a fixed population of
+ * processes, each round dequeues one process and enqueues it back, the
+ * way CPUs cycle through get_proc()/put_proc(). Built twice by
+ * `make bench`: queue-bench wraps the ring buffer in a mutex like the
+ * scheduler does, queue-bench-lf runs the lock-free build bare.
+ */
+
+#include "queue.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_POPULATION 64
+
+static struct queue_t queue;
+static long iterations;
+
+#ifdef QUEUE_LOCKFREE
+#define BENCH_NAME "lock-free"
+#define bench_lock()
+#define bench_unlock()
+#else
+#define BENCH_NAME "mutex"
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+#define bench_lock()	pthread_mutex_lock(&queue_lock)
+#define bench_unlock()	pthread_mutex_unlock(&queue_lock)
+#endif
+
+static void * bench_routine(void * args) {
+	long i, misses = 0;
+
+	for (i = 0; i < iterations; i++) {
+		struct pcb_t * proc;
+
+		bench_lock();
+		proc = dequeue(&queue);
+		bench_unlock();
+		if (proc == NULL) {
+			misses++;
+			continue;
+		}
+		bench_lock();
+		enqueue(&queue, proc);
+		bench_unlock();
+	}
+	return (void *)misses;
+}
+
+int main(int argc, char * argv[]) {
+	int num_threads = (argc > 1) ? atoi(argv[1]) : 4;
+	struct pcb_t * procs;
+	pthread_t * threads;
+	struct timespec start, end;
+	long misses = 0;
+	int i;
+
+	iterations = (argc > 2) ? atol(argv[2]) : 1000000;
+	if (num_threads <= 0 || iterations <= 0) {
+		printf("Usage: queue-bench [threads] [iterations per thread]\n");
+		return 1;
+	}
+
+	procs = (struct pcb_t *)calloc(BENCH_POPULATION, sizeof(struct pcb_t));
+	threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+	init_queue(&queue, BENCH_POPULATION);
+	for (i = 0; i < BENCH_POPULATION; i++) {
+		procs[i].pid = i + 1;
+		enqueue(&queue, &procs[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_threads; i++)
+		pthread_create(&threads[i], NULL, bench_routine, NULL);
+	for (i = 0; i < num_threads; i++) {
+		void * ret;
+		pthread_join(threads[i], &ret);
+		misses += (long)ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	long ops = 2 * (num_threads * iterations - misses);
+	printf("%-9s %3d threads %10ld ops %8.3f s %8.2f Mops/s (%ld empty dequeues)\n",
+		BENCH_NAME, num_threads, ops, secs, ops / secs / 1e6, misses);
+
+	free_queue(&queue);
+	free(threads);
+	free(procs);
+	return 0;
+}
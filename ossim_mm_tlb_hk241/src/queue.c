@@ -2,32 +2,173 @@
 #include <stdlib.h>
 #include "queue.h"
 
+#ifdef QUEUE_LOCKFREE
+
 int empty(struct queue_t * q) {
-        if (q == NULL) return 1;
-	return (q->size == 0);
+	if (q == NULL) return 1;
+	return __atomic_load_n(&q->deq_pos, __ATOMIC_ACQUIRE) >=
+		__atomic_load_n(&q->enq_pos, __ATOMIC_ACQUIRE);
+}
+
+void init_queue(struct queue_t * q, int capacity) {
+	unsigned long cap = 2;
+
+	while (cap < (unsigned long)capacity)
+		cap <<= 1;
+	q->cell = NULL;
+	q->capacity = cap;
+	q->enq_pos = 0;
+	q->deq_pos = 0;
+}
+
+void free_queue(struct queue_t * q) {
+	free(q->cell);
+	q->cell = NULL;
+	q->enq_pos = 0;
+	q->deq_pos = 0;
+}
+
+/* Allocate the ring on first use, racing allocators keep the winner's */
+static struct queue_cell_t * get_cells(struct queue_t * q) {
+	struct queue_cell_t * cell = __atomic_load_n(&q->cell, __ATOMIC_ACQUIRE);
+	struct queue_cell_t * expected = NULL;
+	unsigned long i;
+
+	if (cell != NULL)
+		return cell;
+
+	cell = (struct queue_cell_t *)malloc(q->capacity * sizeof(struct queue_cell_t));
+	if (cell == NULL) {
+		printf("Cannot allocate queue of %lu processes\n", q->capacity);
+		exit(1);
+	}
+	for (i = 0; i < q->capacity; i++)
+		cell[i].seq = i;
+	if (!__atomic_compare_exchange_n(&q->cell, &expected, cell, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(cell);
+		cell = expected;
+	}
+	return cell;
 }
 
 void enqueue(struct queue_t * q, struct pcb_t * proc) {
-        /* TODO: put a new process to queue [q] */
-        q->proc[q->size] = proc;
-        q->size++;
+	struct queue_cell_t * ring = get_cells(q);
+	struct queue_cell_t * cell;
+	unsigned long mask = q->capacity - 1;
+	unsigned long pos = __atomic_load_n(&q->enq_pos, __ATOMIC_RELAXED);
+
+	while (1) {
+		cell = &ring[pos & mask];
+		long diff = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)pos;
+		if (diff == 0) {
+			/* Cell is free for this position, try to claim it */
+			if (__atomic_compare_exchange_n(&q->enq_pos, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0 && (long)(pos - __atomic_load_n(&q->deq_pos,
+				__ATOMIC_ACQUIRE)) >= (long)q->capacity) {
+			printf("Queue overflow: more than %lu processes\n", q->capacity);
+			exit(1);
+		} else {
+			/* Lost the race, or the dequeue one lap behind has not
+			 * released the cell yet */
+			pos = __atomic_load_n(&q->enq_pos, __ATOMIC_RELAXED);
+		}
+	}
+	cell->proc = proc;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
 }
 
 struct pcb_t * dequeue(struct queue_t * q) {
-        /* TODO: return a pcb whose prioprity is the highest
-         * in the queue [q] and remember to remove it from q
-         * */
-	if(empty(q)) return NULL;
+	struct queue_cell_t * ring = __atomic_load_n(&q->cell, __ATOMIC_ACQUIRE);
+	struct queue_cell_t * cell;
+	struct pcb_t * proc;
+	unsigned long mask = q->capacity - 1;
+	unsigned long pos = __atomic_load_n(&q->deq_pos, __ATOMIC_RELAXED);
+
+	if (ring == NULL)
+		return NULL;
+
+	while (1) {
+		cell = &ring[pos & mask];
+		long diff = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)(pos + 1);
+		if (diff == 0) {
+			/* Cell holds the item for this position, try to take it */
+			if (__atomic_compare_exchange_n(&q->deq_pos, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&q->deq_pos, __ATOMIC_RELAXED);
+		}
+	}
+	proc = cell->proc;
+	/* Hand the cell to the enqueue one lap ahead */
+	__atomic_store_n(&cell->seq, pos + mask + 1, __ATOMIC_RELEASE);
+	return proc;
+}
+
+#else
+
+int empty(struct queue_t * q) {
+        if (q == NULL) return 1;
+	return (q->size == 0);
+}
 
-	// If the queue is not empty ...
-	struct pcb_t *temp = q->proc[0];
+void init_queue(struct queue_t * q, int capacity) {
+	int cap = 1;
 
-	for(int i = 0; i < q->size - 1; i++) {
-		q->proc[i] = q->proc[i + 1];
+	/* Keep the capacity a power of two so the ring index is a mask */
+	while (cap < capacity)
+		cap <<= 1;
+	q->proc = NULL;
+	q->head = 0;
+	q->size = 0;
+	q->capacity = cap;
+}
+
+void free_queue(struct queue_t * q) {
+	free(q->proc);
+	q->proc = NULL;
+	q->head = 0;
+	q->size = 0;
+}
+
+/* Double the storage, unrolling the ring so the oldest process is at 0 */
+static void grow_queue(struct queue_t * q) {
+	int cap = (q->proc == NULL) ? q->capacity : q->capacity << 1;
+	struct pcb_t ** proc = (struct pcb_t **)malloc(cap * sizeof(struct pcb_t *));
+	int i;
+
+	if (proc == NULL) {
+		printf("Cannot grow queue to %d processes\n", cap);
+		exit(1);
 	}
+	for (i = 0; i < q->size; i++)
+		proc[i] = q->proc[(q->head + i) & (q->capacity - 1)];
+	free(q->proc);
+	q->proc = proc;
+	q->head = 0;
+	q->capacity = cap;
+}
 
-	q->proc[q->size - 1] = NULL;
-	q->size -= 1;
-        return temp;
+void enqueue(struct queue_t * q, struct pcb_t * proc) {
+	if (q->proc == NULL || q->size == q->capacity)
+		grow_queue(q);
+	q->proc[(q->head + q->size) & (q->capacity - 1)] = proc;
+	q->size++;
 }
 
+struct pcb_t * dequeue(struct queue_t * q) {
+	if (empty(q)) return NULL;
+
+	struct pcb_t * temp = q->proc[q->head];
+	q->head = (q->head + 1) & (q->capacity - 1);
+	q->size--;
+	return temp;
+}
+
+#endif
+
@@ -0,0 +1,232 @@
+
+#include "rbtree.h"
+
+#define RB_RED		0
+#define RB_BLACK	1
+
+#define is_black(node)	((node) == NULL || (node)->color == RB_BLACK)
+
+static void rotate_left(struct rb_root * root, struct rb_node * x) {
+	struct rb_node * y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL)
+		y->left->parent = x;
+	y->parent = x->parent;
+	if (x->parent == NULL)
+		root->node = y;
+	else if (x == x->parent->left)
+		x->parent->left = y;
+	else
+		x->parent->right = y;
+	y->left = x;
+	x->parent = y;
+}
+
+static void rotate_right(struct rb_root * root, struct rb_node * x) {
+	struct rb_node * y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL)
+		y->right->parent = x;
+	y->parent = x->parent;
+	if (x->parent == NULL)
+		root->node = y;
+	else if (x == x->parent->right)
+		x->parent->right = y;
+	else
+		x->parent->left = y;
+	y->right = x;
+	x->parent = y;
+}
+
+struct rb_node * rb_next(struct rb_node * node) {
+	struct rb_node * parent;
+
+	if (node->right != NULL) {
+		node = node->right;
+		while (node->left != NULL)
+			node = node->left;
+		return node;
+	}
+	while ((parent = node->parent) != NULL && node == parent->right)
+		node = parent;
+	return parent;
+}
+
+void rb_insert(struct rb_root * root, struct rb_node * node,
+	int (*less)(struct rb_node * a, struct rb_node * b))
+{
+	struct rb_node ** link = &root->node, * parent = NULL;
+	int leftmost = 1;
+
+	while (*link != NULL) {
+		parent = *link;
+		if (less(node, parent)) {
+			link = &parent->left;
+		} else {
+			link = &parent->right;
+			leftmost = 0;
+		}
+	}
+	node->parent = parent;
+	node->left = node->right = NULL;
+	node->color = RB_RED;
+	*link = node;
+	if (leftmost)
+		root->leftmost = node;
+
+	/* A red parent is never the root, so the grandparent exists */
+	while (node->parent != NULL && node->parent->color == RB_RED) {
+		struct rb_node * p = node->parent, * g = p->parent, * u;
+
+		if (p == g->left) {
+			u = g->right;
+			if (!is_black(u)) {
+				p->color = u->color = RB_BLACK;
+				g->color = RB_RED;
+				node = g;
+				continue;
+			}
+			if (node == p->right) {
+				rotate_left(root, p);
+				node = p;
+				p = node->parent;
+			}
+			p->color = RB_BLACK;
+			g->color = RB_RED;
+			rotate_right(root, g);
+		} else {
+			u = g->left;
+			if (!is_black(u)) {
+				p->color = u->color = RB_BLACK;
+				g->color = RB_RED;
+				node = g;
+				continue;
+			}
+			if (node == p->left) {
+				rotate_right(root, p);
+				node = p;
+				p = node->parent;
+			}
+			p->color = RB_BLACK;
+			g->color = RB_RED;
+			rotate_left(root, g);
+		}
+	}
+	root->node->color = RB_BLACK;
+}
+
+static void transplant(struct rb_root * root, struct rb_node * u,
+	struct rb_node * v)
+{
+	if (u->parent == NULL)
+		root->node = v;
+	else if (u == u->parent->left)
+		u->parent->left = v;
+	else
+		u->parent->right = v;
+	if (v != NULL)
+		v->parent = u->parent;
+}
+
+/* Restore the black height above [x], which may be NULL hence [parent] */
+static void erase_fixup(struct rb_root * root, struct rb_node * x,
+	struct rb_node * parent)
+{
+	struct rb_node * w;
+
+	while (x != root->node && is_black(x)) {
+		if (x == parent->left) {
+			w = parent->right;
+			if (!is_black(w)) {
+				w->color = RB_BLACK;
+				parent->color = RB_RED;
+				rotate_left(root, parent);
+				w = parent->right;
+			}
+			if (is_black(w->left) && is_black(w->right)) {
+				w->color = RB_RED;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (is_black(w->right)) {
+				w->left->color = RB_BLACK;
+				w->color = RB_RED;
+				rotate_right(root, w);
+				w = parent->right;
+			}
+			w->color = parent->color;
+			parent->color = RB_BLACK;
+			w->right->color = RB_BLACK;
+			rotate_left(root, parent);
+		} else {
+			w = parent->left;
+			if (!is_black(w)) {
+				w->color = RB_BLACK;
+				parent->color = RB_RED;
+				rotate_right(root, parent);
+				w = parent->left;
+			}
+			if (is_black(w->left) && is_black(w->right)) {
+				w->color = RB_RED;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (is_black(w->left)) {
+				w->right->color = RB_BLACK;
+				w->color = RB_RED;
+				rotate_left(root, w);
+				w = parent->left;
+			}
+			w->color = parent->color;
+			parent->color = RB_BLACK;
+			w->left->color = RB_BLACK;
+			rotate_right(root, parent);
+		}
+		x = root->node;
+	}
+	if (x != NULL)
+		x->color = RB_BLACK;
+}
+
+void rb_erase(struct rb_root * root, struct rb_node * node) {
+	struct rb_node * x, * parent, * y = node;
+	int color = node->color;
+
+	if (root->leftmost == node)
+		root->leftmost = rb_next(node);
+
+	if (node->left == NULL) {
+		x = node->right;
+		parent = node->parent;
+		transplant(root, node, node->right);
+	} else if (node->right == NULL) {
+		x = node->left;
+		parent = node->parent;
+		transplant(root, node, node->left);
+	} else {
+		/* Replace [node] by its successor */
+		y = node->right;
+		while (y->left != NULL)
+			y = y->left;
+		color = y->color;
+		x = y->right;
+		if (y->parent == node) {
+			parent = y;
+		} else {
+			parent = y->parent;
+			transplant(root, y, y->right);
+			y->right = node->right;
+			y->right->parent = y;
+		}
+		transplant(root, node, y);
+		y->left = node->left;
+		y->left->parent = y;
+		y->color = node->color;
+	}
+	if (color == RB_BLACK)
+		erase_fixup(root, x, parent);
+}
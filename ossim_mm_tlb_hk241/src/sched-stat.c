@@ -0,0 +1,150 @@
+
+#include "sched-stat.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef SCHED_STAT
+
+/* Numbers of a finished process, all times are in time slots */
+struct sched_stat_t {
+	uint32_t pid;
+	uint32_t prio;
+	uint64_t arrival;
+	uint64_t first_dispatch;
+	uint64_t finish;
+	uint64_t wait;
+	uint32_t ctx_switches;
+	uint32_t migrations;
+	uint32_t nr_dispatch;
+	uint64_t quantum_sum;
+	uint32_t quantum;
+};
+
+static struct sched_stat_t * records;
+static int nr_records;
+static int max_records;
+
+void init_sched_stat(int num_procs) {
+	records = (struct sched_stat_t *)
+		calloc(num_procs, sizeof(struct sched_stat_t));
+	max_records = num_procs;
+	nr_records = 0;
+}
+
+/*
+ * The pcb fields are only touched by whoever holds the process: the
+ * loader before add_proc(), the CPU running it, or the CPU putting it
+ * back before it is visible in a run queue.
+ */
+void stat_enqueue(struct pcb_t * proc, int arrival) {
+	uint64_t now = current_time();
+
+	if (arrival) {
+		proc->arrival = now;
+		proc->wait = 0;
+		proc->nr_dispatch = 0;
+		proc->quantum_sum = 0;
+	}
+	proc->ready_since = now;
+}
+
+void stat_dispatch(struct pcb_t * proc) {
+	uint64_t now = current_time();
+
+	if (proc->nr_dispatch++ == 0)
+		proc->first_dispatch = now;
+	proc->quantum_sum += proc->quantum;
+	proc->wait += now - proc->ready_since;
+}
+
+void stat_finish(struct pcb_t * proc) {
+	int i = __atomic_fetch_add(&nr_records, 1, __ATOMIC_RELAXED);
+	struct sched_stat_t * rec;
+
+	if (i >= max_records)
+		return;
+	rec = &records[i];
+	rec->pid = proc->pid;
+#ifdef MLQ_SCHED
+	rec->prio = proc->prio;
+#endif
+	rec->arrival = proc->arrival;
+	rec->first_dispatch = proc->first_dispatch;
+	rec->finish = current_time();
+	rec->wait = proc->wait;
+	rec->ctx_switches = proc->perf.ctx_switches;
+	rec->migrations = proc->migrations;
+	rec->nr_dispatch = proc->nr_dispatch;
+	rec->quantum_sum = proc->quantum_sum;
+	rec->quantum = proc->quantum;
+}
+
+static int cmp_u64(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int cmp_pid(const void * a, const void * b) {
+	const struct sched_stat_t * x = a, * y = b;
+	return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+/* Nearest rank percentile of the sorted [val] */
+static uint64_t percentile(uint64_t * val, int n, int p) {
+	int rank = (p * n + 99) / 100;
+	return val[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_dist(const char * name, uint64_t * val, int n) {
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum += val[i];
+	qsort(val, n, sizeof(uint64_t), cmp_u64);
+	printf("%-10s %6.1f %5lu %5lu %5lu %5lu\n", name, (double)sum / n,
+		percentile(val, n, 50), percentile(val, n, 95),
+		percentile(val, n, 99), val[n - 1]);
+}
+
+void report_sched_stat(void) {
+	int i, n = nr_records < max_records ? nr_records : max_records;
+	uint64_t * response, * turnaround, * wait;
+
+	if (n == 0)
+		goto out;
+
+	qsort(records, n, sizeof(struct sched_stat_t), cmp_pid);
+	response = (uint64_t *)malloc(3 * n * sizeof(uint64_t));
+	turnaround = response + n;
+	wait = turnaround + n;
+
+	printf("----------------SCHEDULING STATS----------------\n");
+	printf(" PID PRIO ARRIVE FIRST FINISH RESPONSE TURNAROUND  WAIT SWITCH MIGRATE  QAVG QLAST\n");
+	for (i = 0; i < n; i++) {
+		struct sched_stat_t * rec = &records[i];
+
+		response[i] = rec->first_dispatch - rec->arrival;
+		turnaround[i] = rec->finish - rec->arrival;
+		wait[i] = rec->wait;
+		printf("%4u %4u %6lu %5lu %6lu %8lu %10lu %5lu %6u %7u %5.1f %5u\n",
+			rec->pid, rec->prio, rec->arrival, rec->first_dispatch,
+			rec->finish, response[i], turnaround[i], wait[i],
+			rec->ctx_switches, rec->migrations,
+			rec->nr_dispatch ? (double)rec->quantum_sum / rec->nr_dispatch : 0,
+			rec->quantum);
+	}
+	printf("%-10s %6s %5s %5s %5s %5s\n", "", "mean", "p50", "p95", "p99", "max");
+	print_dist("response", response, n);
+	print_dist("turnaround", turnaround, n);
+	print_dist("wait", wait, n);
+	free(response);
+out:
+	free(records);
+	records = NULL;
+	nr_records = max_records = 0;
+}
+
+#endif
@@ -1,133 +1,622 @@
 
 #include "queue.h"
 #include "sched.h"
+#include "sched-stat.h"
+#include "bitops.h"
+#include "timer.h"
 #include <pthread.h>
 
 #include <stdlib.h>
 #include <stdio.h>
-static struct queue_t ready_queue;
-static struct queue_t run_queue;
-static pthread_mutex_t queue_lock;
+#include <string.h>
 
 #ifdef MLQ_SCHED
-static struct queue_t mlq_ready_queue[MAX_PRIO];
-static int slot[MAX_PRIO];
+#define MLQ_BITMAP_SZ DIV_ROUND_UP(MAX_PRIO, BITS_PER_LONG)
+
+/* Fair policy: a slot run by a process of [prio] adds FAIR_SCALE / weight
+ * to its vruntime, weights go linearly from MAX_PRIO (prio 0) down to 1 */
+#define FAIR_SCALE			(1UL << 20)
+#define fair_weight(prio)		(MAX_PRIO - (prio))
+
+#define DEFAULT_POLICY			"mlq"
+#else
+#define DEFAULT_POLICY			"fifo"
 #endif
 
-int queue_empty(void) {
+#ifdef QUEUE_LOCKFREE
+/*
+ * Lock-free queues let add_proc/put_proc enqueue without the run queue
+ * lock, only dispatchers (owner and stealers) serialize on it to keep
+ * the slot budget consistent. The rings cannot grow, so each one is
+ * sized for the whole process population. Policies that do not keep
+ * their processes in queues still need the lock.
+ */
+#define RQ_QUEUE_SIZE(num_procs)	(num_procs)
+#define producer_lock(rq)		do { if (!policy->lockfree) \
+		pthread_mutex_lock(&(rq)->lock); } while (0)
+#define producer_unlock(rq)		do { if (!policy->lockfree) \
+		pthread_mutex_unlock(&(rq)->lock); } while (0)
+#define mark_level(rq, prio)		atomic_set_bit(prio, (rq)->mlq_bitmap)
+#else
+#define RQ_QUEUE_SIZE(num_procs)	QUEUE_INIT_SIZE
+#define producer_lock(rq)		pthread_mutex_lock(&(rq)->lock)
+#define producer_unlock(rq)		pthread_mutex_unlock(&(rq)->lock)
+#define mark_level(rq, prio)		set_bit(prio, (rq)->mlq_bitmap)
+#endif
+
+/*
+ * Per-CPU run queue. Each CPU dispatches from and puts back to its own
+ * queue under its own lock, so CPUs only meet each other when an idle
+ * one steals work or when the loader admits a new process.
+ */
+struct runqueue_t {
+	pthread_mutex_t lock;
+	int nr_running;		// Queued processes, read unlocked as a load hint
+	struct pcb_t * curr;	// Process currently dispatched on this CPU
 #ifdef MLQ_SCHED
-	unsigned long prio;
-	for (prio = 0; prio < MAX_PRIO; prio++)
-		if(!empty(&mlq_ready_queue[prio])) 
-			return -1;
+	struct queue_t mlq_ready_queue[MAX_PRIO];
+	int slot[MAX_PRIO];
+	/* Priority levels holding at least one process */
+	unsigned long mlq_bitmap[MLQ_BITMAP_SZ];
+	/* Priority levels whose slot budget is not full (slot[i] != MAX_PRIO - i) */
+	unsigned long slot_bitmap[MLQ_BITMAP_SZ];
+#ifdef MLQ_PREEMPT
+	int curr_prio;		// Priority of curr, -1 when idle
+	int resched;		// A better process than curr was added here
 #endif
-	return (empty(&ready_queue) && empty(&run_queue));
+	/* Fair policy, queued processes ordered by (vruntime, pid) */
+	struct rb_root fair_tree;
+	uint64_t min_vruntime;	// Never decreases, new arrivals start here
+	uint64_t exec_start;	// Time slot curr was dispatched
+#endif
+	struct queue_t ready_queue;
+	struct queue_t run_queue;
+	/* Owner CPU parked in wait_proc(), under idle_lock */
+	int parked;
+	pthread_cond_t idle_cond;
+	struct timer_id_t * timer_id;
+};
+
+/*
+ * Scheduling policy, picked at startup by set_sched_policy(). The hooks
+ * are called with rq->lock held, except put_proc/add_proc of a lockfree
+ * policy in the QUEUE_LOCKFREE build.
+ */
+struct sched_policy_t {
+	const char * name;
+	struct pcb_t * (*get_proc)(struct runqueue_t * rq);
+	void (*put_proc)(struct runqueue_t * rq, struct pcb_t * proc);
+	void (*add_proc)(struct runqueue_t * rq, struct pcb_t * proc);
+	/* [proc] was stolen from [from] to run on [to], may be NULL */
+	void (*migrate)(struct runqueue_t * from, struct runqueue_t * to,
+		struct pcb_t * proc);
+	int lockfree;
+};
+
+static const struct sched_policy_t * policy;
+
+static struct runqueue_t * runqueues;
+static int num_rq;
+static int next_rq;	// Round robin start for admissions, loader only
+static int base_slot;	// time_slot of the config
+
+/* CPUs parked in wait_proc() until a process is added or put back */
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static int nr_idle;
+static int loading_done;
+
+static int rq_load(struct runqueue_t * rq) {
+	return __atomic_load_n(&rq->nr_running, __ATOMIC_RELAXED)
+		+ (__atomic_load_n(&rq->curr, __ATOMIC_RELAXED) != NULL);
+}
+
+int queue_empty(void) {
+	int i;
+	for (i = 0; i < num_rq; i++)
+		if (__atomic_load_n(&runqueues[i].nr_running, __ATOMIC_SEQ_CST))
+			return 0;
+	return 1;
+}
+
+int cpu_queue_empty(int cpu) {
+	return __atomic_load_n(&runqueues[cpu].nr_running, __ATOMIC_SEQ_CST) == 0;
+}
+
+/* Caller holds idle_lock. The CPU is back in the slot barrier from the
+ * next slot on, however late its thread gets to run. */
+static void unpark_cpu(struct runqueue_t * rq) {
+	rq->parked = 0;
+	wake_event(rq->timer_id);
+	pthread_cond_signal(&rq->idle_cond);
+}
+
+/*
+ * wake_idle - wake a parked CPU after queueing on [rq]
+ * A queued process bumps nr_running before nr_idle is read, a parking
+ * CPU bumps nr_idle before it looks at nr_running: one of the two sees
+ * the other, so no wakeup is lost without taking idle_lock every time.
+ * The owner of [rq] is woken first, a peer only when it may steal.
+ */
+static void wake_idle(struct runqueue_t * rq, int min_queued) {
+	int i;
+
+	if (__atomic_load_n(&nr_idle, __ATOMIC_SEQ_CST) == 0 ||
+	    __atomic_load_n(&rq->nr_running, __ATOMIC_SEQ_CST) < min_queued)
+		return;
+	pthread_mutex_lock(&idle_lock);
+	if (rq->parked) {
+		unpark_cpu(rq);
+	} else if (__atomic_load_n(&rq->nr_running, __ATOMIC_SEQ_CST) >=
+		   MIGRATE_THRESHOLD) {
+		for (i = 0; i < num_rq; i++) {
+			if (runqueues[i].parked) {
+				unpark_cpu(&runqueues[i]);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&idle_lock);
 }
 
-void init_scheduler(void) {
+/* Would get_proc(cpu) find something, either locally or to steal */
+static int proc_available(int cpu) {
+	int i;
+	for (i = 0; i < num_rq; i++) {
+		int load = __atomic_load_n(&runqueues[i].nr_running, __ATOMIC_SEQ_CST);
+		if (load >= (i == cpu ? 1 : MIGRATE_THRESHOLD))
+			return 1;
+	}
+	return 0;
+}
+
+void wait_proc(int cpu, struct timer_id_t * timer_id) {
+	struct runqueue_t * rq = &runqueues[cpu];
+
+	pthread_mutex_lock(&idle_lock);
+	rq->timer_id = timer_id;
+	rq->parked = 1;
+	__atomic_add_fetch(&nr_idle, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&idle_lock);
+	/* Parked before leaving: leaving may end the slot, and the timed
+	 * events of the boundary must find us to wake */
+	park_event(timer_id);
+	pthread_mutex_lock(&idle_lock);
+	while (rq->parked && !proc_available(cpu) && !loading_done)
+		pthread_cond_wait(&rq->idle_cond, &idle_lock);
+	rq->parked = 0;
+	__atomic_sub_fetch(&nr_idle, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&idle_lock);
+	unpark_event(timer_id);
+}
+
+void finish_loading(void) {
+	int i;
+
+	pthread_mutex_lock(&idle_lock);
+	loading_done = 1;
+	for (i = 0; i < num_rq; i++) {
+		if (runqueues[i].parked)
+			unpark_cpu(&runqueues[i]);
+	}
+	pthread_mutex_unlock(&idle_lock);
+}
+
+void init_scheduler(int num_cpus, int num_procs, int time_slot) {
+	int i;
+
+	if (policy == NULL)
+		set_sched_policy(DEFAULT_POLICY);
+	num_rq = num_cpus;
+	base_slot = time_slot;
+	runqueues = (struct runqueue_t *)
+		calloc(num_cpus, sizeof(struct runqueue_t));
+	for (i = 0; i < num_cpus; i++) {
+		struct runqueue_t * rq = &runqueues[i];
 #ifdef MLQ_SCHED
-	int i ;
+		int prio;
 
-	for (i = 0; i < MAX_PRIO; i++) 
-	{
-		mlq_ready_queue[i].size = 0;
-		slot[i] = MAX_PRIO - i;
+		for (prio = 0; prio < MAX_PRIO; prio++)
+		{
+			init_queue(&rq->mlq_ready_queue[prio], RQ_QUEUE_SIZE(num_procs));
+			rq->slot[prio] = MAX_PRIO - prio;
+		}
+		rq->fair_tree = RB_ROOT;
+#endif
+		init_queue(&rq->ready_queue, RQ_QUEUE_SIZE(num_procs));
+		init_queue(&rq->run_queue, RQ_QUEUE_SIZE(num_procs));
+		pthread_mutex_init(&rq->lock, NULL);
+		pthread_cond_init(&rq->idle_cond, NULL);
 	}
+}
+
+void finish_scheduler(void) {
+	int i;
+	for (i = 0; i < num_rq; i++) {
+		struct runqueue_t * rq = &runqueues[i];
+#ifdef MLQ_SCHED
+		int prio;
+
+		for (prio = 0; prio < MAX_PRIO; prio++)
+			free_queue(&rq->mlq_ready_queue[prio]);
 #endif
-	ready_queue.size = 0;
-	run_queue.size = 0;
-	pthread_mutex_init(&queue_lock, NULL);
+		free_queue(&rq->ready_queue);
+		free_queue(&rq->run_queue);
+		pthread_mutex_destroy(&rq->lock);
+		pthread_cond_destroy(&rq->idle_cond);
+	}
+	free(runqueues);
+	runqueues = NULL;
+	num_rq = 0;
 }
 
 #ifdef MLQ_SCHED
-/* 
+/*
  *  Stateful design for routine calling
  *  based on the priority and our MLQ policy
  *  We implement stateful here using transition technique
  *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
+ *
+ *  The levels are not walked one by one: mlq_bitmap tells which levels
+ *  are non-empty and slot_bitmap which ones have a used slot budget.
+ *  A linear walk would refill slot[] of every level it passes before
+ *  picking one, so we refill exactly the used levels below the pick.
+ *
+ *  Caller holds rq->lock.
  */
-struct pcb_t * get_mlq_proc(void) {
+static void clear_level(struct runqueue_t * rq, int prio) {
+#ifdef QUEUE_LOCKFREE
+	/* A producer may have enqueued between the empty check and the
+	 * clear, its own mark can be lost so look once more */
+	atomic_clear_bit(prio, rq->mlq_bitmap);
+	if (!empty(&rq->mlq_ready_queue[prio]))
+		atomic_set_bit(prio, rq->mlq_bitmap);
+#else
+	clear_bit(prio, rq->mlq_bitmap);
+#endif
+}
+
+static struct pcb_t * get_mlq_proc(struct runqueue_t * rq) {
 	struct pcb_t * process = NULL;
-	/*TODO: get a process from PRIORITY [ready_queue].
-	 * Remember to use lock to protect the queue.
-	 */
-	pthread_mutex_lock(&queue_lock);
-	int i;
-	for (i = 0; i < MAX_PRIO; i++)
+	unsigned long prio, i;
+
+	prio = find_first_bit(rq->mlq_bitmap, MAX_PRIO);
+	while (prio < MAX_PRIO && rq->slot[prio] == 0)
+		prio = find_next_bit(rq->mlq_bitmap, MAX_PRIO, prio + 1);
+
+	for (i = find_first_bit(rq->slot_bitmap, MAX_PRIO); i < prio;
+	     i = find_next_bit(rq->slot_bitmap, MAX_PRIO, i + 1))
 	{
-		if (empty(&mlq_ready_queue[i]) || slot[i] == 0)
-		{
-			slot[i] = MAX_PRIO - i;
-			continue;
-		}
-		process = dequeue(&mlq_ready_queue[i]);
-		slot[i]--;
-		break;
+		rq->slot[i] = MAX_PRIO - i;
+		clear_bit(i, rq->slot_bitmap);
+	}
+
+	/* When every queued level has used up its slots, the walk refilled
+	 * them all and this dispatch gets nothing, the CPU asks again in the
+	 * next slot */
+	if (prio < MAX_PRIO)
+	{
+		process = dequeue(&rq->mlq_ready_queue[prio]);
+		if (empty(&rq->mlq_ready_queue[prio]))
+			clear_level(rq, prio);
+		/* Lock-free enqueue still in flight, retry on next dispatch */
+		if (process == NULL)
+			return NULL;
+		rq->slot[prio]--;
+		set_bit(prio, rq->slot_bitmap);
 	}
-	pthread_mutex_unlock(&queue_lock);
 	return process;
 }
 
+static void put_mlq_proc(struct runqueue_t * rq, struct pcb_t * proc) {
+	enqueue(&rq->mlq_ready_queue[proc->prio], proc);
+	mark_level(rq, proc->prio);
+}
+
+static const struct sched_policy_t mlq_policy = {
+	.name = "mlq",
+	.get_proc = get_mlq_proc,
+	.put_proc = put_mlq_proc,
+	.add_proc = put_mlq_proc,
+	.lockfree = 1,
+};
+
+/*
+ * Fair policy: every CPU runs the queued process with the smallest
+ * vruntime, which grows by the slots it ran scaled down by the weight
+ * of its prio, so CPU time is shared in proportion to the weights.
+ */
+static int fair_less(struct rb_node * a, struct rb_node * b) {
+	struct pcb_t * x = rb_entry(a, struct pcb_t, run_node);
+	struct pcb_t * y = rb_entry(b, struct pcb_t, run_node);
 
-void put_mlq_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	if (x->vruntime != y->vruntime)
+		return x->vruntime < y->vruntime;
+	return x->pid < y->pid;
 }
 
-void add_mlq_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);	
+static struct pcb_t * get_fair_proc(struct runqueue_t * rq) {
+	struct rb_node * node = rb_first(&rq->fair_tree);
+	struct pcb_t * proc;
+
+	if (node == NULL)
+		return NULL;
+	rb_erase(&rq->fair_tree, node);
+	proc = rb_entry(node, struct pcb_t, run_node);
+	if (proc->vruntime > rq->min_vruntime)
+		__atomic_store_n(&rq->min_vruntime, proc->vruntime, __ATOMIC_RELAXED);
+	return proc;
 }
 
-struct pcb_t * get_proc(void) {
-	return get_mlq_proc();
+static void put_fair_proc(struct runqueue_t * rq, struct pcb_t * proc) {
+	uint64_t ran = current_time() - rq->exec_start;
+
+	/* Even a process put back within its first slot has used the CPU */
+	if (ran == 0)
+		ran = 1;
+	proc->vruntime += ran * FAIR_SCALE / fair_weight(proc->prio);
+	rb_insert(&rq->fair_tree, &proc->run_node, fair_less);
 }
 
-void put_proc(struct pcb_t * proc) {
-	return put_mlq_proc(proc);
+static void add_fair_proc(struct runqueue_t * rq, struct pcb_t * proc) {
+	proc->vruntime = rq->min_vruntime;
+	rb_insert(&rq->fair_tree, &proc->run_node, fair_less);
 }
 
-void add_proc(struct pcb_t * proc) {
-	return add_mlq_proc(proc);
+/* Keep the lead or lag [proc] had on its old queue, not the absolute
+ * vruntime: the two queues may have advanced by very different amounts */
+static void migrate_fair_proc(struct runqueue_t * from,
+	struct runqueue_t * to, struct pcb_t * proc)
+{
+	int64_t lag = proc->vruntime -
+		__atomic_load_n(&from->min_vruntime, __ATOMIC_RELAXED);
+	uint64_t base = __atomic_load_n(&to->min_vruntime, __ATOMIC_RELAXED);
+
+	proc->vruntime = (lag < 0 && (uint64_t)-lag > base) ? 0 : base + lag;
 }
-#else
-struct pcb_t * get_proc(void) {
-	struct pcb_t * process = NULL;
-	/*TODO: get a process from [ready_queue].
-	 * Remember to use lock to protect the queue.
-	 * */
-	pthread_mutex_lock(&queue_lock);
+
+static const struct sched_policy_t fair_policy = {
+	.name = "fair",
+	.get_proc = get_fair_proc,
+	.put_proc = put_fair_proc,
+	.add_proc = add_fair_proc,
+	.migrate = migrate_fair_proc,
+	.lockfree = 0,
+};
+#endif
+
+static struct pcb_t * get_fifo_proc(struct runqueue_t * rq) {
+	struct pcb_t * proc;
 
 	// Check if the ready queue is empty
-	if (empty(&ready_queue))
+	if (empty(&rq->ready_queue))
 	{
 		// Move processes from the run queue to the ready queue
-		while (!empty(run_queue))
+		while ((proc = dequeue(&rq->run_queue)) != NULL)
 		{
-			enqueue(&ready_queue, dequeue(&run_queue));
+			enqueue(&rq->ready_queue, proc);
 		}
 	}
 
 	// Get a process from the ready queue
-	process = dequeue(&ready_queue);
-	pthread_mutex_unlock(&queue_lock);
+	return dequeue(&rq->ready_queue);
+}
+
+static void put_fifo_proc(struct runqueue_t * rq, struct pcb_t * proc) {
+	enqueue(&rq->run_queue, proc);
+}
+
+static void add_fifo_proc(struct runqueue_t * rq, struct pcb_t * proc) {
+	enqueue(&rq->ready_queue, proc);
+}
+
+static const struct sched_policy_t fifo_policy = {
+	.name = "fifo",
+	.get_proc = get_fifo_proc,
+	.put_proc = put_fifo_proc,
+	.add_proc = add_fifo_proc,
+	.lockfree = 1,
+};
+
+static const struct sched_policy_t * policies[] = {
+#ifdef MLQ_SCHED
+	&mlq_policy,
+	&fair_policy,
+#endif
+	&fifo_policy,
+};
+
+#define rq_get_proc(rq)			policy->get_proc(rq)
+#define rq_put_proc(rq, proc)		policy->put_proc(rq, proc)
+#define rq_add_proc(rq, proc)		policy->add_proc(rq, proc)
+
+int set_sched_policy(const char * name) {
+	int i;
+
+	for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		if (strcmp(policies[i]->name, name) == 0) {
+			policy = policies[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static struct pcb_t * take_proc(struct runqueue_t * rq) {
+	struct pcb_t * process;
 
+	pthread_mutex_lock(&rq->lock);
+	process = rq_get_proc(rq);
+	if (process != NULL)
+		__atomic_sub_fetch(&rq->nr_running, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&rq->lock);
 	return process;
 }
 
+/*
+ * steal_proc - take a process from the busiest peer of [cpu]
+ * The load is sampled without locks, only the victim queue is locked
+ * while stealing so two queue locks are never held together. Peers
+ * queueing fewer than MIGRATE_THRESHOLD processes more than [cpu] keep
+ * them (and their warm TLB entries).
+ */
+static struct pcb_t * steal_proc(int cpu) {
+	struct pcb_t * process;
+	int my_load = __atomic_load_n(&runqueues[cpu].nr_running, __ATOMIC_RELAXED);
+	int i, busiest = -1, max_load = my_load + MIGRATE_THRESHOLD - 1;
+
+	for (i = 0; i < num_rq; i++) {
+		int load;
+		if (i == cpu)
+			continue;
+		load = __atomic_load_n(&runqueues[i].nr_running, __ATOMIC_RELAXED);
+		if (load > max_load) {
+			max_load = load;
+			busiest = i;
+		}
+	}
+	if (busiest < 0)
+		return NULL;
 
-void put_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&run_queue, proc);
-	pthread_mutex_unlock(&queue_lock);
+	process = take_proc(&runqueues[busiest]);
+	if (process != NULL && policy->migrate != NULL)
+		policy->migrate(&runqueues[busiest], &runqueues[cpu], process);
+	return process;
 }
 
-void add_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&ready_queue, proc);
-	pthread_mutex_unlock(&queue_lock);	
+struct pcb_t * get_proc(int cpu) {
+	struct runqueue_t * rq = &runqueues[cpu];
+	struct pcb_t * process;
+
+#ifdef MLQ_PREEMPT
+	/* Whatever asked for the preemption is picked up right now */
+	__atomic_store_n(&rq->resched, 0, __ATOMIC_RELAXED);
+#endif
+	process = take_proc(rq);
+	if (process == NULL)
+		process = steal_proc(cpu);
+	if (process != NULL) {
+		if (process->last_cpu >= 0 && process->last_cpu != cpu)
+			process->migrations++;
+		process->last_cpu = cpu;
+		stat_dispatch(process);
+	}
+	__atomic_store_n(&rq->curr, process, __ATOMIC_RELAXED);
+#ifdef MLQ_SCHED
+	rq->exec_start = current_time();
+#endif
+#ifdef MLQ_PREEMPT
+	__atomic_store_n(&rq->curr_prio, process ? (int)process->prio : -1,
+		__ATOMIC_RELAXED);
+#endif
+	return process;
+}
+
+void put_proc(int cpu, struct pcb_t * proc) {
+	struct runqueue_t * rq = &runqueues[cpu];
+
+	proc->perf.ctx_switches++;
+	stat_enqueue(proc, 0);
+	producer_lock(rq);
+	rq_put_proc(rq, proc);
+	__atomic_add_fetch(&rq->nr_running, 1, __ATOMIC_SEQ_CST);
+	producer_unlock(rq);
+	/* This CPU takes one back right away, only what a peer may steal
+	 * is worth waking it for */
+	wake_idle(rq, MIGRATE_THRESHOLD + 1);
+}
+
+#ifdef MLQ_PREEMPT
+int need_resched(int cpu) {
+	return __atomic_exchange_n(&runqueues[cpu].resched, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * preempt_target - CPU running the lowest priority process, if [proc]
+ * beats it, or -1. curr_prio is sampled without locks, a CPU switching
+ * process meanwhile only costs one extra put/get round.
+ */
+static int preempt_target(struct pcb_t * proc) {
+	int i, victim = -1, worst = proc->prio;
+
+	for (i = 0; i < num_rq; i++) {
+		int prio = __atomic_load_n(&runqueues[i].curr_prio, __ATOMIC_RELAXED);
+		if (prio > worst) {
+			worst = prio;
+			victim = i;
+		}
+	}
+	return victim;
 }
 #endif
 
+/* Quantum a process starts with and is pulled back to */
+static uint32_t base_quantum(struct pcb_t * proc) {
+#if defined(ADAPTIVE_QUANTUM) && defined(MLQ_SCHED)
+	return base_slot + base_slot * (QUANTUM_PRIO_SCALE - 1) * proc->prio
+		/ (MAX_PRIO - 1);
+#else
+	return base_slot;
+#endif
+}
+
+/*
+ * Faulting processes get their quantum halved, they would mostly hold
+ * the CPU waiting on memory. Calc-only slices double it up to the cap,
+ * switching them out more often only costs. Anything else drifts back
+ * to the base quantum of its priority.
+ */
+void end_slice(struct pcb_t * proc, int faults, int calc_only) {
+#ifdef ADAPTIVE_QUANTUM
+	uint32_t base = base_quantum(proc);
+
+	if (faults > 0) {
+		proc->quantum = proc->quantum > 1 ? proc->quantum / 2 : 1;
+	} else if (calc_only) {
+		proc->quantum *= 2;
+		if (proc->quantum > base * QUANTUM_MAX_SCALE)
+			proc->quantum = base * QUANTUM_MAX_SCALE;
+	} else if (proc->quantum < base) {
+		proc->quantum = (proc->quantum + base + 1) / 2;
+	} else {
+		proc->quantum = (proc->quantum + base) / 2;
+	}
+#endif
+}
+
+void add_proc(struct pcb_t * proc) {
+	struct runqueue_t * rq;
+	int i, target = next_rq, min_load = rq_load(&runqueues[next_rq]);
+#ifdef MLQ_PREEMPT
+	int victim = -1;
+#endif
+
+	/* Least loaded queue, ties go round robin from next_rq */
+	for (i = 1; i < num_rq && min_load > 0; i++) {
+		int cpu = (next_rq + i) % num_rq;
+		int load = rq_load(&runqueues[cpu]);
+		if (load < min_load) {
+			min_load = load;
+			target = cpu;
+		}
+	}
+#ifdef MLQ_PREEMPT
+	/* Every CPU is busy: queue behind the worst running process and
+	 * have its CPU give it up at the next instruction */
+	if (policy == &mlq_policy && min_load > 0 && (victim = preempt_target(proc)) >= 0)
+		target = victim;
+#endif
+	next_rq = (target + 1) % num_rq;
+
+	rq = &runqueues[target];
+	proc->quantum = base_quantum(proc);
+	stat_enqueue(proc, 1);
+	producer_lock(rq);
+	rq_add_proc(rq, proc);
+	__atomic_add_fetch(&rq->nr_running, 1, __ATOMIC_SEQ_CST);
+	producer_unlock(rq);
+#ifdef MLQ_PREEMPT
+	if (victim >= 0)
+		__atomic_store_n(&rq->resched, 1, __ATOMIC_RELAXED);
+#endif
+	wake_idle(rq, 1);
+}
@@ -1,136 +1,672 @@
-
 #include "timer.h"
+#include "os-cfg.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#ifdef TIMER_STAT
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
-static pthread_t _timer;
+/*
+ * Slot barrier
+ * A device done with the current slot arrives at its leaf node of a
+ * combining tree. The last arrival at a node goes on to the parent, the
+ * last one at the root ends the slot: it advances the time, applies the
+ * pending membership changes and reverses the sense every device waits
+ * on. Up to TIMER_CENTRAL_MAX devices all share the root, which is then
+ * a plain sense-reversing central barrier. No timer thread is involved.
+ */
+#define TIMER_CENTRAL_MAX	8
+#define TIMER_FANIN		4
+#define TIMER_SPIN		200	// Sense checks before sleeping
 
-struct timer_id_container_t {
-	struct timer_id_t id;
-	struct timer_id_container_t * next;
-};
+#define PENDING_LEAVE	1
+#define PENDING_JOIN	2
+
+struct timer_node_t {
+	int count;	// Arrivals still missing in the current slot
+	int expected;	// Children taking part, devices or nodes
+	struct timer_node_t * parent;
+} __attribute__((aligned(64)));
+
+static struct timer_node_t * nodes;
 
-static struct timer_id_container_t * dev_list = NULL;
+static struct timer_id_t * dev_list = NULL;
+static int nr_devices = 0;
+static int max_devices;	// Room in pending[] and timed[]
+static int nr_leaves;
 
 static uint64_t _time;
+static int sense;	// Reversed at each slot boundary
 
 static int timer_started = 0;
-static int timer_stop = 0;
-
-
-static void * timer_routine(void * args) {
-	while (!timer_stop) {
-		printf("Time slot %3lu\n", current_time());
-		int fsh = 0;
-		int event = 0;
-		/* Wait for all devices have done the job in current
-		 * time slot */
-		struct timer_id_container_t * temp;
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.event_lock);
-			while (!temp->id.done && !temp->id.fsh) {
-				pthread_cond_wait(
-					&temp->id.event_cond,
-					&temp->id.event_lock
-				);
-			}
-			if (temp->id.fsh) {
-				fsh++;
-			}
-			event++;
-			pthread_mutex_unlock(&temp->id.event_lock);
-		}
 
-		/* Increase the time slot */
-		_time++;
-		
-		/* Let devices continue their job */
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.timer_lock);
-			temp->id.done = 0;
-			pthread_cond_signal(&temp->id.timer_cond);
-			pthread_mutex_unlock(&temp->id.timer_lock);
+/* Membership, changed by the device ending the slot only */
+static pthread_mutex_t join_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timer_id_t ** pending;
+static int nr_pending;
+static int nr_members;
+
+/* Devices in wait_until(), a min-heap on wake_at */
+static struct timer_id_t ** timed;
+static int nr_timed;
+
+/* Timed events, a min-heap on (time, seq) so that events due in the
+ * same slot fire in the order they were added */
+struct timer_event_t {
+	uint64_t time;
+	uint64_t seq;
+	void (*fire)(void * arg);
+	void * arg;
+};
+
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timer_event_t * events;
+static int nr_events;
+static int max_events;
+static uint64_t event_seq;
+
+/* Set while the device ending a slot fires the events, devices joining
+ * meanwhile take part in the slot about to start */
+static int in_boundary;
+
+#ifdef TIMER_STAT
+/*
+ * Wall clock accounting. Each device charges the time since its last
+ * state change to work, barrier wait or idle; the device ending a slot
+ * was the last to arrive in it and times the slot.
+ */
+#define TIMER_HIST	16	// Slot wall time buckets, powers of two in us
+
+static uint64_t start_ns;
+static uint64_t slot_ns;	// When the last slot ended
+static uint64_t max_slot_ns;
+static uint64_t nr_slots;
+static uint64_t slot_hist[TIMER_HIST];
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define charge(dev, counter)	do { uint64_t t = now_ns(); \
+		(dev)->counter += t - (dev)->mark_ns; (dev)->mark_ns = t; } while (0)
+
+/* Caller ends the slot */
+static void time_slot_stat(void) {
+	uint64_t t = now_ns(), us = (t - slot_ns) / 1000;
+	int b = 0;
+
+	if (t - slot_ns > max_slot_ns)
+		max_slot_ns = t - slot_ns;
+	while (us > 0 && b < TIMER_HIST - 1) {
+		us >>= 1;
+		b++;
+	}
+	slot_hist[b]++;
+	nr_slots++;
+	slot_ns = t;
+}
+#else
+#define charge(dev, counter)
+#define time_slot_stat()
+#endif
+
+/* Devices done spinning sleep until the sense is reversed. A futex on
+ * the sense itself wakes them all without making them queue on a mutex
+ * the way a condition variable broadcast does. */
+static int nr_sleepers;
+#ifdef __linux__
+#define sleep_on(addr, old) \
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, old, NULL, NULL, 0)
+#define wake_all(addr) \
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0)
+#else
+static pthread_mutex_t wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_cond = PTHREAD_COND_INITIALIZER;
+
+#define sleep_on(addr, old)	do { pthread_mutex_lock(&wait_lock); \
+		if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) == (old)) \
+			pthread_cond_wait(&wait_cond, &wait_lock); \
+		pthread_mutex_unlock(&wait_lock); } while (0)
+#define wake_all(addr)		do { pthread_mutex_lock(&wait_lock); \
+		pthread_cond_broadcast(&wait_cond); \
+		pthread_mutex_unlock(&wait_lock); } while (0)
+#endif
+
+#ifdef TIMER_FASTFORWARD
+static void timed_push(struct timer_id_t * dev) {
+	int i = nr_timed++;
+
+	while (i > 0 && timed[(i - 1) / 2]->wake_at > dev->wake_at) {
+		timed[i] = timed[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	timed[i] = dev;
+}
+#endif
+
+static struct timer_id_t * timed_pop(void) {
+	struct timer_id_t * top = timed[0], * last = timed[--nr_timed];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < nr_timed) {
+		if (child + 1 < nr_timed &&
+		    timed[child + 1]->wake_at < timed[child]->wake_at)
+			child++;
+		if (last->wake_at <= timed[child]->wake_at)
+			break;
+		timed[i] = timed[child];
+		i = child;
+	}
+	timed[i] = last;
+	return top;
+}
+
+#define event_before(a, b) \
+	((a)->time < (b)->time || ((a)->time == (b)->time && (a)->seq < (b)->seq))
+
+/* Caller holds event_lock */
+static void event_push(struct timer_event_t * ev) {
+	int i;
+
+	if (nr_events == max_events) {
+		max_events = max_events ? 2 * max_events : 16;
+		events = (struct timer_event_t *)
+			realloc(events, max_events * sizeof(struct timer_event_t));
+		if (events == NULL) {
+			printf("Cannot allocate the timed events\n");
+			exit(1);
 		}
-		if (fsh == event) {
+	}
+	for (i = nr_events++; i > 0 && event_before(ev, &events[(i - 1) / 2]);
+			i = (i - 1) / 2)
+		events[i] = events[(i - 1) / 2];
+	events[i] = *ev;
+}
+
+/* Caller holds event_lock */
+static void event_pop(struct timer_event_t * ev) {
+	struct timer_event_t * last = &events[--nr_events];
+	int i = 0, child;
+
+	*ev = events[0];
+	while ((child = 2 * i + 1) < nr_events) {
+		if (child + 1 < nr_events &&
+		    event_before(&events[child + 1], &events[child]))
+			child++;
+		if (!event_before(&events[child], last))
 			break;
+		events[i] = events[child];
+		i = child;
+	}
+	events[i] = *last;
+}
+
+/* Add or remove one child of [node], up to the first ancestor that keeps
+ * taking part. Only called at a slot boundary, when count == expected. */
+static void adjust_node(struct timer_node_t * node, int delta) {
+	while (node != NULL) {
+		int was_active = node->expected > 0;
+
+		node->expected += delta;
+		node->count += delta;
+		if (was_active == (node->expected > 0))
+			break;
+		node = node->parent;
+	}
+}
+
+/* Caller holds join_lock */
+static void apply_pending(void) {
+	int i;
+
+	for (i = 0; i < nr_pending; i++) {
+		struct timer_id_t * dev = pending[i];
+
+		if (dev->pending == PENDING_LEAVE) {
+			adjust_node(dev->leaf, -1);
+			dev->member = 0;
+			nr_members--;
+		} else if (dev->pending == PENDING_JOIN) {
+			adjust_node(dev->leaf, 1);
+			dev->member = 1;
+			nr_members++;
 		}
+		dev->pending = 0;
 	}
-	pthread_exit(args);
+	nr_pending = 0;
+}
+
+static void end_slot(void) {
+	uint64_t now = _time + 1;
+	struct timer_event_t ev;
+	int i, woken;
+
+	time_slot_stat();
+	pthread_mutex_lock(&join_lock);
+	apply_pending();
+
+	/* Nothing can happen before the next timed wake up or event, and no
+	 * member is left to end the slots in between */
+	if (nr_members == 0) {
+		uint64_t next = UINT64_MAX;
+
+		if (nr_timed > 0)
+			next = timed[0]->wake_at;
+		pthread_mutex_lock(&event_lock);
+		if (nr_events > 0 && events[0].time < next)
+			next = events[0].time;
+		pthread_mutex_unlock(&event_lock);
+#ifdef TIMER_FASTFORWARD
+		/* Skip them */
+		if (next != UINT64_MAX && next > now)
+			now = next;
+#else
+		/* Go through them here */
+		for (; next != UINT64_MAX && now < next; now++)
+			printf("Time slot %3lu\n", now);
+#endif
+	}
+	__atomic_store_n(&_time, now, __ATOMIC_RELAXED);
+	printf("Time slot %3lu\n", now);
+	in_boundary = 1;
+	pthread_mutex_unlock(&join_lock);
+
+	/* Every member waits for the sense, the events run alone. They
+	 * may add events or wake devices, so no lock is held. */
+	pthread_mutex_lock(&event_lock);
+	while (nr_events > 0 && events[0].time <= now) {
+		event_pop(&ev);
+		pthread_mutex_unlock(&event_lock);
+		ev.fire(ev.arg);
+		pthread_mutex_lock(&event_lock);
+	}
+	pthread_mutex_unlock(&event_lock);
+
+	pthread_mutex_lock(&join_lock);
+	/* Devices woken by the events */
+	apply_pending();
+	in_boundary = 0;
+
+	/* Popped devices are kept past the end of the heap, they are woken
+	 * only once the sense is reversed or they would take part in the
+	 * slot being ended */
+	for (woken = nr_timed; nr_timed > 0 && timed[0]->wake_at <= now; ) {
+		struct timer_id_t * dev = timed_pop();
+
+		adjust_node(dev->leaf, 1);
+		dev->member = 1;
+		nr_members++;
+		dev->sense = !sense;
+		timed[nr_timed] = dev;
+	}
+
+	/* Sleepers bump nr_sleepers before their last look at the sense,
+	 * so either they see the new sense or we see them */
+	__atomic_store_n(&sense, !sense, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&nr_sleepers, __ATOMIC_SEQ_CST) > 0)
+		wake_all(&sense);
+	for (i = nr_timed; i < woken; i++) {
+		__atomic_store_n(&timed[i]->asleep, 0, __ATOMIC_RELEASE);
+		wake_all(&timed[i]->asleep);
+	}
+	pthread_mutex_unlock(&join_lock);
+}
+
+static void arrive(struct timer_id_t * dev) {
+	struct timer_node_t * node;
+
+	for (node = dev->leaf; node != NULL; node = node->parent) {
+		if (__atomic_sub_fetch(&node->count, 1, __ATOMIC_ACQ_REL) > 0)
+			return;
+		/* Nobody arrives here again before the slot ends */
+		node->count = node->expected;
+	}
+#ifdef TIMER_STAT
+	dev->nr_last++;
+#endif
+	end_slot();
+}
+
+static void wait_slot(struct timer_id_t * dev) {
+	int i;
+
+	for (i = 0; i < TIMER_SPIN; i++) {
+		if (__atomic_load_n(&sense, __ATOMIC_ACQUIRE) == dev->sense)
+			return;
+	}
+	__atomic_add_fetch(&nr_sleepers, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&sense, __ATOMIC_SEQ_CST) != dev->sense)
+		sleep_on(&sense, !dev->sense);
+	__atomic_sub_fetch(&nr_sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Leave at the end of the current slot, [dev] still counts in it */
+static void leave(struct timer_id_t * dev) {
+	pthread_mutex_lock(&join_lock);
+	dev->pending = PENDING_LEAVE;
+	pending[nr_pending++] = dev;
+	pthread_mutex_unlock(&join_lock);
+	arrive(dev);
 }
 
 void next_slot(struct timer_id_t * timer_id) {
-	/* Tell to timer that we have done our job in current slot */
-	pthread_mutex_lock(&timer_id->event_lock);
-	timer_id->done = 1;
-	pthread_cond_signal(&timer_id->event_cond);
-	pthread_mutex_unlock(&timer_id->event_lock);
+	/* Tell the barrier that we have done our job in current slot,
+	 * then wait for going to next slot */
+	timer_id->sense = !timer_id->sense;
+	charge(timer_id, work_ns);
+	arrive(timer_id);
+	wait_slot(timer_id);
+	charge(timer_id, wait_ns);
+}
+
+void wait_until(struct timer_id_t * timer_id, uint64_t time) {
+#ifdef TIMER_FASTFORWARD
+	if (time <= current_time())
+		return;
+	charge(timer_id, work_ns);
+	/* Leave the barrier, end_slot() brings us back at [time] */
+	pthread_mutex_lock(&join_lock);
+	timer_id->wake_at = time;
+	timer_id->asleep = 1;
+	timed_push(timer_id);
+	pthread_mutex_unlock(&join_lock);
+	leave(timer_id);
+	while (__atomic_load_n(&timer_id->asleep, __ATOMIC_ACQUIRE))
+		sleep_on(&timer_id->asleep, 1);
+	charge(timer_id, idle_ns);
+#else
+	while (current_time() < time)
+		next_slot(timer_id);
+#endif
+}
+
+void add_timed_event(uint64_t time, void (*fire)(void * arg), void * arg) {
+	struct timer_event_t ev;
 
-	/* Wait for going to next slot */
-	pthread_mutex_lock(&timer_id->timer_lock);
-	while (timer_id->done) {
-		pthread_cond_wait(
-			&timer_id->timer_cond,
-			&timer_id->timer_lock
-		);
+	if (time <= current_time()) {
+		fire(arg);
+		return;
 	}
-	pthread_mutex_unlock(&timer_id->timer_lock);
+	ev.time = time;
+	ev.fire = fire;
+	ev.arg = arg;
+	pthread_mutex_lock(&event_lock);
+	ev.seq = event_seq++;
+	event_push(&ev);
+	pthread_mutex_unlock(&event_lock);
+}
+
+uint64_t next_event_time() {
+	uint64_t time = UINT64_MAX;
+
+	pthread_mutex_lock(&event_lock);
+	if (nr_events > 0)
+		time = events[0].time;
+	pthread_mutex_unlock(&event_lock);
+	return time;
 }
 
 uint64_t current_time() {
-	return _time;
+	return __atomic_load_n(&_time, __ATOMIC_RELAXED);
+}
+
+/* Lay the tree out level by level, leaves first, and spread the
+ * devices over the leaves in list order */
+static void build_tree(void) {
+	int fanin = nr_devices <= TIMER_CENTRAL_MAX ? nr_devices : TIMER_FANIN;
+	int nr_nodes = 0, width, base, i;
+	struct timer_id_t * dev;
+
+	if (fanin == 0)
+		fanin = 1;
+	nr_leaves = nr_devices > 0 ? (nr_devices + fanin - 1) / fanin : 1;
+	for (width = nr_leaves; ; width = (width + TIMER_FANIN - 1) / TIMER_FANIN) {
+		nr_nodes += width;
+		if (width == 1)
+			break;
+	}
+	if (posix_memalign((void **)&nodes, 64,
+			nr_nodes * sizeof(struct timer_node_t)) != 0) {
+		printf("Cannot allocate the slot barrier\n");
+		exit(1);
+	}
+
+	for (base = 0, width = nr_leaves; width > 1; ) {
+		int upper = (width + TIMER_FANIN - 1) / TIMER_FANIN;
+		for (i = 0; i < width; i++)
+			nodes[base + i].parent = &nodes[base + width + i / TIMER_FANIN];
+		base += width;
+		width = upper;
+	}
+	nodes[base].parent = NULL;
+	for (i = 0; i < nr_nodes; i++)
+		nodes[i].count = nodes[i].expected = 0;
+
+	for (i = 0, dev = dev_list; dev != NULL; dev = dev->next, i++) {
+		dev->leaf = &nodes[i / fanin];
+		adjust_node(dev->leaf, 1);
+	}
+}
+
+/* Caller holds join_lock once the timer started */
+static void grow_devices(int nr) {
+	if (nr <= max_devices)
+		return;
+	max_devices = max_devices ? 2 * max_devices : 8;
+	if (max_devices < nr)
+		max_devices = nr;
+	pending = (struct timer_id_t **)
+		realloc(pending, max_devices * sizeof(struct timer_id_t *));
+	timed = (struct timer_id_t **)
+		realloc(timed, max_devices * sizeof(struct timer_id_t *));
+	if (pending == NULL || timed == NULL) {
+		printf("Cannot allocate the slot barrier\n");
+		exit(1);
+	}
 }
 
 void start_timer() {
+#ifdef TIMER_STAT
+	struct timer_id_t * dev;
+
+	start_ns = slot_ns = now_ns();
+	for (dev = dev_list; dev != NULL; dev = dev->next)
+		dev->mark_ns = start_ns;
+#endif
 	timer_started = 1;
-	pthread_create(&_timer, NULL, timer_routine, NULL);
+	grow_devices(nr_devices);
+	nr_members = nr_devices;
+	build_tree();
+	printf("Time slot %3lu\n", current_time());
 }
 
 void detach_event(struct timer_id_t * event) {
-	pthread_mutex_lock(&event->event_lock);
+	pthread_mutex_lock(&join_lock);
 	event->fsh = 1;
-	pthread_cond_signal(&event->event_cond);
-	pthread_mutex_unlock(&event->event_lock);
+#ifdef TIMER_STAT
+	charge(event, work_ns);
+	event->done_ns = event->mark_ns - start_ns;
+#endif
+	if (event->pending == PENDING_JOIN) {
+		/* Never got to take part, end_slot() skips the entry */
+		event->pending = 0;
+		pthread_mutex_unlock(&join_lock);
+		return;
+	}
+	pthread_mutex_unlock(&join_lock);
+	if (event->member)
+		leave(event);
+}
+
+void park_event(struct timer_id_t * event) {
+	charge(event, work_ns);
+	leave(event);
+}
+
+/* Caller holds join_lock. Return 0 if nobody is left to end the slot. */
+static int join(struct timer_id_t * event) {
+	if (event->pending == PENDING_LEAVE) {
+		/* Parked and back within the same slot, stay a member but
+		 * the slot in flight is already done with */
+		event->pending = 0;
+		event->sense = !sense;
+	} else if (event->pending == 0 && !event->member) {
+		if (nr_members == 0 && !in_boundary)
+			return 0;
+		/* end_slot() counts it in and reverses the sense to this
+		 * one, so it may go on right after the boundary */
+		event->pending = PENDING_JOIN;
+		event->sense = !sense;
+		pending[nr_pending++] = event;
+	}
+	return 1;
+}
+
+void wake_event(struct timer_id_t * event) {
+	pthread_mutex_lock(&join_lock);
+	join(event);
+	pthread_mutex_unlock(&join_lock);
+}
+
+void unpark_event(struct timer_id_t * event) {
+	pthread_mutex_lock(&join_lock);
+	if (!join(event)) {
+		/* Nobody takes part in the slot in flight, time stands
+		 * still until we do */
+		adjust_node(event->leaf, 1);
+		event->member = 1;
+		nr_members++;
+		event->sense = sense;
+		pthread_mutex_unlock(&join_lock);
+		charge(event, idle_ns);
+		return;
+	}
+	pthread_mutex_unlock(&join_lock);
+	wait_slot(event);
+	charge(event, idle_ns);
+}
+
+/* Leaf with the fewest devices taking part, caller holds join_lock */
+static struct timer_node_t * least_loaded_leaf(void) {
+	struct timer_node_t * leaf = &nodes[0];
+	int i;
+
+	for (i = 1; i < nr_leaves; i++)
+		if (nodes[i].expected < leaf->expected)
+			leaf = &nodes[i];
+	return leaf;
 }
 
 struct timer_id_t * attach_event() {
+	struct timer_id_t * dev =
+		(struct timer_id_t *)malloc(sizeof(struct timer_id_t));
+
+	dev->leaf = NULL;
+	dev->sense = 0;
+	dev->member = 1;
+	dev->pending = 0;
+	dev->fsh = 0;
+	dev->asleep = 0;
+#ifdef TIMER_STAT
+	dev->work_ns = dev->wait_ns = dev->idle_ns = dev->done_ns = 0;
+	dev->nr_last = 0;
+	dev->mark_ns = timer_started ? now_ns() : 0;
+#endif
+	pthread_mutex_lock(&join_lock);
 	if (timer_started) {
-		return NULL;
-	}else{
-		struct timer_id_container_t * container =
-			(struct timer_id_container_t*)malloc(
-				sizeof(struct timer_id_container_t)		
-			);
-		container->id.done = 0;
-		container->id.fsh = 0;
-		pthread_cond_init(&container->id.event_cond, NULL);
-		pthread_mutex_init(&container->id.event_lock, NULL);
-		pthread_cond_init(&container->id.timer_cond, NULL);
-		pthread_mutex_init(&container->id.timer_lock, NULL);
-		if (dev_list == NULL) {
-			dev_list = container;
-			dev_list->next = NULL;
-		}else{
-			container->next = dev_list;
-			dev_list = container;
-		}
-		return &(container->id);
+		/* Added to a running barrier: parked until its thread calls
+		 * unpark_event(), which makes it count from a slot boundary */
+		grow_devices(nr_devices + 1);
+		dev->member = 0;
+		dev->leaf = least_loaded_leaf();
 	}
+#ifdef TIMER_STAT
+	/* Concurrent attaches each get their own devs[] slot */
+	dev->id = nr_devices;
+#endif
+	dev->next = dev_list;
+	dev_list = dev;
+	nr_devices++;
+	pthread_mutex_unlock(&join_lock);
+	return dev;
 }
 
+#ifdef TIMER_STAT
+static void report_timer_stat(void) {
+	struct timer_id_t ** devs, * dev, * straggler = NULL;
+	uint64_t max_hist = 0;
+	int i;
+
+	if (nr_devices == 0 || nr_slots == 0)
+		return;
+	/* The list is newest first, print in attach order */
+	devs = (struct timer_id_t **)malloc(nr_devices * sizeof(*devs));
+	for (dev = dev_list; dev != NULL; dev = dev->next)
+		devs[dev->id] = dev;
+
+	printf("----------------TIMER STATS----------------\n");
+	printf(" DEV  WORK(ms)  WAIT(ms)  IDLE(ms)  DONE(ms)  LAST\n");
+	for (i = 0; i < nr_devices; i++) {
+		dev = devs[i];
+		printf("%4d %9.2f %9.2f %9.2f %9.2f %5u\n", dev->id,
+			dev->work_ns / 1e6, dev->wait_ns / 1e6,
+			dev->idle_ns / 1e6, dev->done_ns / 1e6, dev->nr_last);
+		if (straggler == NULL || dev->nr_last > straggler->nr_last)
+			straggler = dev;
+	}
+	printf("straggler: device %d, last to arrive in %u of %lu slots\n",
+		straggler->id, straggler->nr_last, nr_slots);
+
+	printf("slot wall time: mean %.1f us, max %.1f us\n",
+		(slot_ns - start_ns) / 1e3 / nr_slots, max_slot_ns / 1e3);
+	for (i = 0; i < TIMER_HIST; i++)
+		if (slot_hist[i] > max_hist)
+			max_hist = slot_hist[i];
+	for (i = 0; i < TIMER_HIST; i++) {
+		int bar;
+
+		if (slot_hist[i] == 0)
+			continue;
+		if (i == 0)
+			printf("%12s", "< 1 us");
+		else
+			printf("%6lu-%-5lu", 1UL << (i - 1), 1UL << i);
+		printf(" %8lu ", slot_hist[i]);
+		for (bar = 0; bar < (int)(slot_hist[i] * 40 / max_hist); bar++)
+			putchar('#');
+		putchar('\n');
+	}
+	free(devs);
+}
+#endif
+
 void stop_timer() {
-	timer_stop = 1;
-	pthread_join(_timer, NULL);
+#ifdef TIMER_STAT
+	report_timer_stat();
+#endif
 	while (dev_list != NULL) {
-		struct timer_id_container_t * temp = dev_list;
+		struct timer_id_t * temp = dev_list;
 		dev_list = dev_list->next;
-		pthread_cond_destroy(&temp->id.event_cond);
-		pthread_mutex_destroy(&temp->id.event_lock);
-		pthread_cond_destroy(&temp->id.timer_cond);
-		pthread_mutex_destroy(&temp->id.timer_lock);
 		free(temp);
 	}
+	free(nodes);
+	free(pending);
+	free(timed);
+	free(events);
+	events = NULL;
+	nr_events = max_events = 0;
+	nodes = NULL;
+	pending = NULL;
+	timed = NULL;
+	nr_devices = max_devices = 0;
+	timer_started = 0;
 }
-
-
-
-
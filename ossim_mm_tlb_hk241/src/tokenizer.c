@@ -0,0 +1,123 @@
+
+#include "tokenizer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static int is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Skip blanks and newlines up to the next word */
+static void skip_lines(struct tokenizer_t * tok) {
+	while (tok->pos < tok->end &&
+	       (is_blank(*tok->pos) || *tok->pos == '\n')) {
+		if (*tok->pos == '\n')
+			tok->line++;
+		tok->pos++;
+	}
+}
+
+int tok_open(struct tokenizer_t * tok, const char * path) {
+	struct stat st;
+	void * map = NULL;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+	tok->path = path;
+	tok->buf = (const char *)map;
+	tok->pos = tok->buf;
+	tok->end = tok->buf + st.st_size;
+	tok->line = 1;
+	skip_lines(tok);
+	return 0;
+}
+
+void tok_close(struct tokenizer_t * tok) {
+	if (tok->buf != NULL)
+		munmap((void *)tok->buf, tok->end - tok->buf);
+	tok->buf = tok->pos = tok->end = NULL;
+}
+
+size_t tok_word(struct tokenizer_t * tok, const char ** word) {
+	while (tok->pos < tok->end && is_blank(*tok->pos))
+		tok->pos++;
+	*word = tok->pos;
+	while (tok->pos < tok->end && !is_blank(*tok->pos) &&
+	       *tok->pos != '\n')
+		tok->pos++;
+	return tok->pos - *word;
+}
+
+unsigned long tok_number(struct tokenizer_t * tok, const char * what,
+		unsigned long max) {
+	const char * word;
+	size_t i, len = tok_word(tok, &word);
+	unsigned long val = 0;
+
+	if (len == 0)
+		tok_error(tok, "expected %s", what);
+	for (i = 0; i < len; i++) {
+		if (word[i] < '0' || word[i] > '9')
+			tok_error(tok, "expected %s, found '%.*s'",
+				what, (int)len, word);
+		if (val > (max - (word[i] - '0')) / 10)
+			tok_error(tok, "%s %.*s is larger than %lu",
+				what, (int)len, word, max);
+		val = val * 10 + (word[i] - '0');
+	}
+	return val;
+}
+
+void tok_end_line(struct tokenizer_t * tok) {
+	const char * word;
+	size_t len = tok_word(tok, &word);
+
+	if (len > 0)
+		tok_error(tok, "unexpected '%.*s'", (int)len, word);
+	skip_lines(tok);
+}
+
+int tok_eof(struct tokenizer_t * tok) {
+	return tok->pos == tok->end;
+}
+
+void tok_error(struct tokenizer_t * tok, const char * fmt, ...) {
+	va_list ap;
+
+	printf("%s:%u: ", tok->path, tok->line);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	exit(1);
+}
+
+void tok_warning(struct tokenizer_t * tok, const char * fmt, ...) {
+	va_list ap;
+
+	printf("%s:%u: warning: ", tok->path, tok->line);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+